@@ -0,0 +1,263 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal.h
+// @func:	Register access layer for main.c. On the AVR it is just the
+//			avr-libc headers. With HOST_BUILD defined, the registers
+//			are plain variables in hal_host.c, so the same getStatus(),
+//			setMode() and ISR bodies compile as a Linux host target
+//			that a test driver steps by calling the vectors directly.
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef HAL_H
+#define HAL_H
+
+#ifndef HOST_BUILD
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#define HAL_NOINIT	__attribute__((section(".noinit")))	// not cleared on reset
+
+// BODS must follow BODSE within 4 cycles and only lasts 3, so each
+// timed sequence is one asm block, as sleep_bod_disable() is. The
+// probe reads BODS back in the next cycle, it stays 0 on parts
+// without it. The sleep runs sei then sleep right after the write,
+// sei holds off interrupts for one more instruction.
+static inline uint8_t hal_bods_probe(void) {
+	uint8_t mcucr;
+	__asm__ __volatile__ (
+		"in %[mcucr], %[reg]\n\t"
+		"ori %[mcucr], %[bods_bodse]\n\t"
+		"out %[reg], %[mcucr]\n\t"
+		"andi %[mcucr], %[not_bodse]\n\t"
+		"out %[reg], %[mcucr]\n\t"
+		"in %[mcucr], %[reg]"
+		: [mcucr] "=&d" (mcucr)
+		: [reg] "I" (_SFR_IO_ADDR(MCUCR)),
+		  [bods_bodse] "i" (_BV(BODS) | _BV(BODSE)),
+		  [not_bodse] "i" (~_BV(BODSE) & 0xFF));
+	return mcucr;
+}
+static inline void hal_sleep_bods(void) {
+	uint8_t mcucr;
+	__asm__ __volatile__ (
+		"in %[mcucr], %[reg]\n\t"
+		"ori %[mcucr], %[bods_bodse]\n\t"
+		"out %[reg], %[mcucr]\n\t"
+		"andi %[mcucr], %[not_bodse]\n\t"
+		"out %[reg], %[mcucr]\n\t"
+		"sei\n\t"
+		"sleep"
+		: [mcucr] "=&d" (mcucr)
+		: [reg] "I" (_SFR_IO_ADDR(MCUCR)),
+		  [bods_bodse] "i" (_BV(BODS) | _BV(BODSE)),
+		  [not_bodse] "i" (~_BV(BODSE) & 0xFF)
+		: "memory");
+}
+
+#ifdef SIMAVR
+#include "avr_mcu_section.h"	// simavr, embeds the VCD trace setup in the elf
+#endif
+
+#else // HOST_BUILD
+
+#include <stdint.h>
+#include <assert.h>
+
+// Simulated I/O registers, defined in hal_host.c
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t ADCL, ADCH, ADCSRA, ADMUX;
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK, TIFR;
+extern volatile uint8_t MCUCR, MCUSR, WDTCR, PRR, ACSR, DIDR0, CLKPR;
+extern volatile uint8_t GPIOR0, GPIOR1, GPIOR2, SREG;
+
+// Port B
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PB5		5
+
+// ADCSRA, ADMUX
+#define ADEN	7
+#define ADSC	6
+#define ADATE	5
+#define ADIF	4
+#define ADIE	3
+#define ADPS2	2
+#define ADPS1	1
+#define ADPS0	0
+#define MUX3	3
+#define MUX2	2
+
+// Timer 0
+#define COM0A1	7
+#define COM0A0	6
+#define WGM01	1
+#define WGM00	0
+#define CS02	2
+#define CS01	1
+#define CS00	0
+#define OCIE0A	4
+#define OCIE0B	3
+#define TOIE0	1
+#define OCF0A	4
+#define OCF0B	3
+#define TOV0	1
+
+// MCUCR, MCUSR
+#define BODS	7
+#define SE		5
+#define SM1		4
+#define SM0		3
+#define BODSE	2
+#define WDRF	3
+#define BORF	2
+#define EXTRF	1
+#define PORF	0
+
+// WDTCR
+#define WDIF	7
+#define WDIE	6
+#define WDP3	5
+#define WDCE	4
+#define WDE		3
+#define WDP2	2
+#define WDP1	1
+#define WDP0	0
+
+// PRR, ACSR, DIDR0, CLKPR
+#define PRTIM1	3
+#define PRTIM0	2
+#define PRUSI	1
+#define PRADC	0
+#define ACD		7
+#define ADC0D	5
+#define ADC2D	4
+#define ADC3D	3
+#define ADC1D	2
+#define AIN1D	1
+#define AIN0D	0
+#define CLKPCE	7
+
+#define SREG_I	7
+
+// Vectors become plain functions the driver calls
+#define ISR(vector)	void vector(void); void vector(void)
+
+#define sei()	(SREG |= (1 << SREG_I))
+#define cli()	(SREG &= ~(1 << SREG_I))
+
+// util/atomic.h, the block runs with interrupts off and the restore
+// runs on every way out of it
+static inline uint8_t hal_cli_once(void) { cli(); return 1; }
+static inline void hal_sreg_restore(const uint8_t *sreg) { SREG = *sreg; }
+#define ATOMIC_RESTORESTATE	uint8_t hal_sreg __attribute__((__cleanup__(hal_sreg_restore))) = SREG
+#define ATOMIC_BLOCK(type)	for ( type, hal_todo = hal_cli_once(); hal_todo; hal_todo = 0 )
+
+#define PROGMEM
+#define pgm_read_byte(addr)	(*(const uint8_t *)(addr))
+
+#define HAL_NOINIT	// host RAM is never reset
+
+// Sleep only records the request, the driver decides what wakes next
+extern unsigned long hal_sleeps;
+extern void (*hal_sleep_hook)(void);
+void hal_sleep(void);
+#define sleep_enable()		(MCUCR |= (1 << SE))
+#define sleep_disable()		(MCUCR &= ~(1 << SE))
+#define sleep_bod_disable()	(MCUCR |= (1 << BODS))
+#define hal_bods_probe()	( sleep_bod_disable(), MCUCR )	// BODS always there
+#define hal_sleep_bods()	do { sleep_bod_disable(); sei(); sleep_cpu(); } while (0)
+#define sleep_cpu()			hal_sleep()
+#define sleep_mode()		do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+// Bandgap ADC and cell model, the driver sets hal_vcc and services
+// the ADC after each wake, or lets hal_wake() do it
+extern unsigned int hal_vcc;
+extern unsigned long hal_adc_conversions;
+int hal_adc_service(void);
+void hal_wake(void);
+void hal_reset(unsigned char cause);
+extern void (*hal_pulse_hook)(void);
+unsigned int hal_cell_mv(unsigned int soc, unsigned int load);
+
+// Field trace replay. A trace is one record per input change, a line
+// of text "<ms> <PINB hex> <vcc mV>", lines starting with # ignored
+typedef struct {
+	unsigned long ms;		// time since capture start
+	unsigned char pins;		// PINB levels
+	unsigned int vcc;		// supply in mV
+} TraceRecord;
+extern unsigned long hal_ms;
+unsigned int hal_wdt_ms(void);
+int hal_trace_parse(const char *line, TraceRecord *rec);
+TraceRecord *hal_trace_load(const char *name, unsigned int *count);
+unsigned long hal_replay(const TraceRecord *trace, unsigned int count, void (*wake)(void));
+
+#define _delay_us(us)	((void)0)
+#define _delay_ms(ms)	((void)0)
+
+// main.c entry points a driver steps
+void setup(void);
+void loop(void);
+void WDT_vect(void);
+void ADC_vect(void);
+void TIM0_OVF_vect(void);
+void TIM0_COMPA_vect(void);
+void TIM0_COMPB_vect(void);
+
+#endif // HOST_BUILD
+
+// Benchmark markers. With BENCH defined each measured section writes
+// its id to GPIOR0 on entry and id | BENCH_EXIT_FLAG on exit, one OUT
+// instruction each, so a simulator watching GPIOR0 writes can time
+// sections in cycles. Sections nest when an ISR interrupts main code.
+#define BENCH_WDT		1	// WDT_vect
+#define BENCH_ADC		2	// ADC_vect
+#define BENCH_TIM0_OVF	3	// TIM0_OVF_vect
+#define BENCH_TIM0_COMPA 4	// TIM0_COMPA_vect
+#define BENCH_TIM0_COMPB 5	// TIM0_COMPB_vect
+#define BENCH_STATUS	6	// getStatus()
+#define BENCH_SETMODE	7	// setMode()
+#define BENCH_SEQUENCE	8	// stepSequence(), one tick, inside WDT_vect
+#define BENCH_EXIT_FLAG	0x80
+
+#define BENCH_SECTIONS	16	// ids fit in GPIOR0 below BENCH_EXIT_FLAG
+
+#if defined(BENCH) && defined(HOST_BUILD)
+// The host has no cycle count, it counts section entries instead so a
+// driver can cost them with the CYC_* figures in host/power_model.h
+extern unsigned long hal_bench[BENCH_SECTIONS];
+#define BENCH_ENTER(id)	(hal_bench[(id)]++)
+#define BENCH_EXIT(id)	((void)0)
+#elif defined(BENCH)
+#define BENCH_ENTER(id)	(GPIOR0 = (id))
+#define BENCH_EXIT(id)	(GPIOR0 = (id) | BENCH_EXIT_FLAG)
+#else
+#define BENCH_ENTER(id)	((void)0)
+#define BENCH_EXIT(id)	((void)0)
+#endif
+
+// Invariant checks. With CHECK_INVARIANTS defined checkInvariants()
+// runs before every sleep. On the host a failure asserts, on the chip
+// the failed id goes to GPIOR1 for a simulator or debugger to see.
+#define INV_CUTOFF_HELD	1	// switch on, no USB, critical cell drives OUT_ENA low
+#define INV_OUT_ENA_LOW	2	// OUT_ENA is never driven high
+#define INV_ADC_PD		3	// ADC is off when power down is selected
+#define INV_TIM0_PD		4	// no Timer 0 interrupts in power down
+
+#ifdef CHECK_INVARIANTS
+#ifdef HOST_BUILD
+#define HAL_CHECK(id, cond)	assert((id) && (cond))
+#else
+#define HAL_CHECK(id, cond)	do { if ( !(cond) ) GPIOR1 = (id); } while (0)
+#endif
+#endif
+
+#endif // HAL_H
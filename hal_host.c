@@ -0,0 +1,283 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_host.c
+// @func:	Simulated registers for the HOST_BUILD of main.c. A driver
+//			sets PINB and hal_vcc, calls the vectors, and reads the
+//			outputs back. Not part of the AVR build.
+//////////////////////////////////////////////////////////////////////////
+
+#ifdef HOST_BUILD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+
+volatile uint8_t PINB, DDRB, PORTB;
+volatile uint8_t ADCL, ADCH, ADCSRA, ADMUX;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK, TIFR;
+volatile uint8_t MCUCR, MCUSR = (1 << PORF), WDTCR, PRR, ACSR, DIDR0, CLKPR;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2, SREG;
+
+unsigned long hal_sleeps = 0;		// sleep_cpu calls
+void (*hal_sleep_hook)(void) = 0;	// driver callback on each sleep
+void (*hal_pulse_hook)(void) = 0;	// driver callback as an led pulse ends
+
+unsigned int hal_vcc = 4000;			// supply in mV, read through the bandgap
+unsigned long hal_adc_conversions = 0;	// completed conversions
+
+// Li-ion open circuit voltage in mV at 0, 10 .. 100% charge, a typical
+// single cell curve at room temperature
+const unsigned int CELL_OCV[11] = {
+	3000, 3450, 3550, 3620, 3680, 3740, 3800, 3880, 3960, 4060, 4180
+};
+const unsigned int HAL_CELL_MOHM = 80;	// cell and protection resistance
+
+unsigned long hal_ms = 0;	// simulated time of the current wake
+
+unsigned long hal_bench[BENCH_SECTIONS];	// BENCH section entries
+
+// main.c RAM, when a driver links it with .data and .bss renamed to
+// fw_data and fw_bss, see the fuzz rule in host/Makefile
+extern char __start_fw_data[] __attribute__((weak));
+extern char __stop_fw_data[] __attribute__((weak));
+extern char __start_fw_bss[] __attribute__((weak));
+extern char __stop_fw_bss[] __attribute__((weak));
+static char *fwImage;	// fw_data as loaded, before any firmware ran
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_copy
+// @func:	byte copy, or clear if from is 0, kept out of reach of the
+//			address sanitizer, which guards the padding between globals
+//////////////////////////////////////////////////////////////////////////
+__attribute__((no_sanitize_address)) static void hal_copy(char *to, const char *from, size_t size) {
+	
+	volatile char *p = to;	// volatile keeps the loop from becoming memcpy
+	
+	while ( size-- )
+		*p++ = from ? *from++ : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_sleep
+// @func:	stands in for the sleep instruction, counts it and hands
+//			control to the driver
+//////////////////////////////////////////////////////////////////////////
+void hal_sleep(void) {
+	
+	hal_sleeps++;
+	if ( hal_sleep_hook )
+		hal_sleep_hook();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_save_image
+// @func:	keeps a copy of fw_data before main() runs, for hal_reset
+//////////////////////////////////////////////////////////////////////////
+__attribute__((constructor)) static void hal_save_image(void) {
+	
+	size_t size = __stop_fw_data - __start_fw_data;
+	
+	if ( !__start_fw_data || !( fwImage = malloc(size + 1) ) )
+		return;
+	hal_copy(fwImage, __start_fw_data, size);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_reset
+// @func:	a reset of the chip. Registers go to 0 except MCUSR, which
+//			holds the cause. If main.c was linked with its RAM gathered
+//			into fw_data and fw_bss, that RAM is restored as the C
+//			startup would leave it, so a driver can restart from
+//			power-on within one process. Call setup() afterwards.
+// @parm:	cause - MCUSR reset flags, (1 << PORF) for power-on
+//////////////////////////////////////////////////////////////////////////
+void hal_reset(unsigned char cause) {
+	
+	DDRB = PORTB = 0;
+	ADCL = ADCH = ADCSRA = ADMUX = 0;
+	TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = TIMSK = TIFR = 0;
+	MCUCR = WDTCR = PRR = ACSR = DIDR0 = CLKPR = 0;
+	GPIOR0 = GPIOR1 = GPIOR2 = SREG = 0;
+	MCUSR = cause;
+	if ( fwImage ) {
+		hal_copy(__start_fw_data, fwImage, __stop_fw_data - __start_fw_data);
+		hal_copy(__start_fw_bss, 0, __stop_fw_bss - __start_fw_bss);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_adc_service
+// @func:	completes a pending conversion of the 1.1V bandgap against
+//			hal_vcc and calls ADC_vect, as the ADC would once ADSC is
+//			set. Returns 1 if a conversion was completed.
+//////////////////////////////////////////////////////////////////////////
+int hal_adc_service(void) {
+	
+	unsigned long adc;
+	
+	if ( !( ADCSRA & (1 << ADEN) ) || !( ADCSRA & (1 << ADSC) ) )
+		return 0;
+	adc = hal_vcc ? 1126400UL / hal_vcc : 1023;
+	if ( adc > 1023 )
+		adc = 1023;
+	if ( adc < 1 )		// above 1126V, ADC_vect divides by the result
+		adc = 1;
+	ADCL = adc & 0xFF;
+	ADCH = adc >> 8;
+	ADCSRA &= ~(1 << ADSC);	// conversion done
+	hal_adc_conversions++;
+	if ( ADCSRA & (1 << ADIE) )
+		ADC_vect();
+	return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_cell_mv
+// @func:	terminal voltage of the modelled cell, for a driver that
+//			steps hal_vcc through a discharge
+// @parm:	soc - state of charge in 1/10 percent, 0 to 1000
+// @parm:	load - load current in mA
+// @rtrn:	cell voltage in mV under load
+//////////////////////////////////////////////////////////////////////////
+unsigned int hal_cell_mv(unsigned int soc, unsigned int load) {
+	
+	unsigned int i, ocv, sag;
+	
+	if ( soc >= 1000 )
+		ocv = CELL_OCV[10];
+	else {
+		i = soc / 100;
+		ocv = CELL_OCV[i] + (unsigned long)(CELL_OCV[i + 1] - CELL_OCV[i]) * (soc % 100) / 100;
+	}
+	sag = (unsigned long)load * HAL_CELL_MOHM / 1000;
+	return sag < ocv ? ocv - sag : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_wdt_ms
+// @func:	watchdog period selected by the WDP bits in WDTCR
+// @rtrn:	period in ms
+//////////////////////////////////////////////////////////////////////////
+unsigned int hal_wdt_ms(void) {
+	
+	unsigned char wdp = WDTCR & ( (1 << WDP2) | (1 << WDP1) | (1 << WDP0) );
+	
+	if ( WDTCR & (1 << WDP3) )
+		wdp += 8;
+	return 16U << wdp;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_trace_parse
+// @func:	reads one line of a field trace
+// @parm:	line - text of the line
+// @parm:	rec - record filled in
+// @rtrn:	1 for a record, 0 for a comment, blank or bad line
+//////////////////////////////////////////////////////////////////////////
+int hal_trace_parse(const char *line, TraceRecord *rec) {
+	
+	unsigned int pins;
+	
+	if ( line[0] == '#' )
+		return 0;
+	if ( sscanf(line, "%lu %x %u", &rec->ms, &pins, &rec->vcc) != 3 )
+		return 0;
+	rec->pins = pins;
+	return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_trace_load
+// @func:	reads a whole field trace file
+// @parm:	name - file name
+// @parm:	count - set to the number of records
+// @rtrn:	malloc'd records for the caller to free, 0 if unreadable
+//////////////////////////////////////////////////////////////////////////
+TraceRecord *hal_trace_load(const char *name, unsigned int *count) {
+	
+	FILE *f = fopen(name, "r");
+	TraceRecord *trace = 0;
+	unsigned int size = 0;
+	char line[128];
+	
+	*count = 0;
+	if ( !f ) {
+		perror(name);
+		return 0;
+	}
+	while ( fgets(line, sizeof(line), f) ) {
+		if ( *count == size ) {
+			size = size ? size * 2 : 256;
+			trace = realloc(trace, size * sizeof(*trace));
+		}
+		*count += hal_trace_parse(line, &trace[*count]);
+	}
+	fclose(f);
+	return trace ? trace : malloc(sizeof(*trace));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_wake
+// @func:	one watchdog wake, with the ADC burst and led pulse it
+//			starts run to completion, as main() would loop through them
+//////////////////////////////////////////////////////////////////////////
+void hal_wake(void) {
+	
+	WDT_vect();
+	loop();
+	while ( hal_adc_service() )	// burst wakes from idle
+		loop();
+	if ( TIMSK & (1 << OCIE0B) ) {	// led pulse ends
+		if ( hal_pulse_hook )
+			hal_pulse_hook();	// OCR0B and the lit leds are still set
+		TIM0_COMPB_vect();
+		loop();
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	hal_replay
+// @func:	runs main.c against a field trace, one watchdog wake at a
+//			time at the period the firmware has selected. Inputs follow
+//			the latest record at or before each wake, ADC bursts and
+//			led pulses run to completion before the next wake. Call
+//			setup() first.
+// @parm:	trace - records in time order
+// @parm:	count - number of records
+// @parm:	wake - called after each wake to compare or log state, or 0
+// @rtrn:	number of wakes replayed
+//////////////////////////////////////////////////////////////////////////
+unsigned long hal_replay(const TraceRecord *trace, unsigned int count, void (*wake)(void)) {
+	
+	unsigned int i = 0;
+	unsigned long wakes = 0;
+	
+	if ( count == 0 )
+		return 0;
+	hal_ms = trace[0].ms;
+	while ( hal_ms <= trace[count - 1].ms ) {
+		while ( i < count && trace[i].ms <= hal_ms ) {
+			PINB = trace[i].pins;
+			hal_vcc = trace[i].vcc;
+			i++;
+		}
+		hal_wake();
+		wakes++;
+		if ( wake )
+			wake();
+		hal_ms += hal_wdt_ms();
+	}
+	return wakes;
+}
+
+#endif // HOST_BUILD
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	energy.c
+// @func:	host driver that estimates average current per mode with
+//			power_model.c. With no argument it holds each of the nine
+//			modes in turn, with a trace file it replays that instead.
+//			usage: energy [trace]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "stimuli.h"
+#include "power_model.h"
+
+extern unsigned char mStatus;
+
+const unsigned long SETTLE_WAKES = 2000;	// wakes to reach the mode
+const double MEASURE_S = 60.0;				// simulated time per mode
+
+PowerTotals totals;
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	holdMode
+// @func:	drives the stimulus for a mode, settles, then measures
+// @rtrn:	mode the firmware settled in
+//////////////////////////////////////////////////////////////////////////
+int holdMode(int mode) {
+	
+	PowerTotals settle;
+	unsigned long i;
+	double start;
+	
+	if ( mode == 7 ) {	// cutoff is only reached by discharging
+		PINB = MODE_STIMULI[6].pins;
+		hal_vcc = MODE_STIMULI[6].vcc;
+		for ( i = 0; i < SETTLE_WAKES; i++ )
+			hal_wake();
+	}
+	PINB = MODE_STIMULI[mode].pins;
+	hal_vcc = MODE_STIMULI[mode].vcc;
+	powerStart(&settle);
+	for ( i = 0; i < SETTLE_WAKES; i++ ) {
+		hal_wake();
+		powerWake(&settle);
+	}
+	start = totals.seconds[mStatus];
+	while ( totals.seconds[mStatus] - start < MEASURE_S ) {
+		hal_wake();
+		powerWake(&totals);
+	}
+	return mStatus;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	powerReplayWake
+// @func:	hal_replay callback
+//////////////////////////////////////////////////////////////////////////
+void powerReplayWake(void) {
+	
+	powerWake(&totals);
+}
+
+
+int main(int argc, char **argv) {
+	
+	int mode, held;
+	unsigned int count;
+	
+	setup();
+	powerStart(&totals);
+	printf("mode                  held  wakes/s  awake ms/s  chip uA  led uA\n");
+	if ( argc > 1 ) {
+		TraceRecord *trace = hal_trace_load(argv[1], &count);
+		
+		if ( !trace )
+			return 1;
+		hal_replay(trace, count, powerReplayWake);
+		free(trace);
+	}
+	for ( mode = 1; mode <= 9; mode++ ) {
+		held = argc > 1 ? mode : holdMode(mode);
+		if ( totals.seconds[mode] <= 0 )
+			continue;
+		printf("%d %-18s  %4d  %7.1f  %10.3f  %7.1f  %6.0f\n", mode, MODE_STIMULI[mode].name,
+			held, totals.wakes[mode] / totals.seconds[mode],
+			totals.awake[mode] * 1000 / totals.seconds[mode],
+			powerChipUa(&totals, mode), powerLedUa(&totals, mode));
+	}
+	printf("total %.0f s, chip %.1f uA average\n", powerTotalSeconds(&totals),
+		powerTotalUc(&totals) / powerTotalSeconds(&totals));
+	return 0;
+}
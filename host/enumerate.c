@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	enumerate.c
+// @func:	host driver that walks every start mode against every level
+//			of the three input pins, the voltage bands and their edges,
+//			each watchdogCount phase of the ADC schedule and, in mode 7,
+//			whether the switch probe is due. Built with CHECK_INVARIANTS,
+//			so a broken rule aborts its case. Reports the mode each case
+//			settles in and any wake that returns without sleeping.
+//			Built with BENCH too, the host markers count section
+//			entries, and each wake is costed with the CYC_* figures of
+//			host/power_model.h. The most awake cycles of any wake in a
+//			transition is reported per start and end mode, and a case
+//			over TRANSITION_CYCLES fails.
+//			usage: enumerate [-v], -v lists every case for diffing
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "stimuli.h"
+#include "power_model.h"
+
+extern unsigned char mStatus;
+extern unsigned char tickCount;
+extern unsigned char watchdogCount;
+extern unsigned char probeCount;
+extern unsigned char probeInterval;
+extern volatile unsigned short voltage;
+extern unsigned short passVoltage;
+extern unsigned char ledPulse;
+extern const unsigned char START_ADC_1S_WATCHDOG;
+extern const unsigned char MODE_STABLE_WAKES;
+extern const unsigned short BATTERY_GOOD;
+extern const unsigned short BATTERY_LOW;
+extern const unsigned short BATTERY_CRITICAL;
+
+const unsigned long SETTLE_WAKES = 5000;	// to reach the start mode
+const unsigned long STEP_WAKES = 1000;		// to commit the next one
+const unsigned short SWEEP_TOP = 4200;		// dimming sweep, mV
+const unsigned short SWEEP_BOTTOM = 3000;
+const unsigned long ADC_BURST = 11;			// ADC_vect runs per burst
+
+// One wake may hold a status pass, a mode change, a sequencer tick, a
+// whole ADC burst and a led pulse, but no section twice
+const unsigned long TRANSITION_CYCLES = CYC_WAKE + CYC_SEQUENCE + CYC_STATUS
+	+ CYC_SETMODE + ADC_BURST * CYC_ADC_SAMPLE + CYC_PULSE;
+
+void setBrightness(void);
+
+typedef struct {
+	unsigned char start;	// mode the case starts in
+	unsigned char pins;		// PINB levels applied
+	unsigned short volt;	// voltage and hal_vcc applied
+	unsigned char wdc;		// watchdogCount applied
+	unsigned char probe;	// mode 7 only, 1 = switch probe due
+	unsigned char end;		// mode after the step, 0 = not reached
+	unsigned char awake;	// wakes that returned without a sleep
+	unsigned long wakes;	// wakes until the end mode committed
+	unsigned long cycles;	// most awake cycles of any one wake
+} Case;
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	wakeCycles
+// @func:	costs the sections entered since the last call
+// @rtrn:	awake cycles, from the CYC_* figures
+//////////////////////////////////////////////////////////////////////////
+unsigned long wakeCycles(void) {
+
+	static const unsigned long CYCLES[BENCH_SECTIONS] = {
+		[BENCH_WDT] = CYC_WAKE,
+		[BENCH_ADC] = CYC_ADC_SAMPLE,
+		[BENCH_TIM0_OVF] = CYC_TIM0_ISR,
+		[BENCH_TIM0_COMPA] = CYC_TIM0_ISR,
+		[BENCH_TIM0_COMPB] = CYC_PULSE,
+		[BENCH_STATUS] = CYC_STATUS,
+		[BENCH_SETMODE] = CYC_SETMODE,
+		[BENCH_SEQUENCE] = CYC_SEQUENCE,
+	};
+	static unsigned long last[BENCH_SECTIONS];
+	unsigned long cycles = 0;
+	unsigned int id;
+
+	for ( id = 0; id < BENCH_SECTIONS; id++ ) {
+		cycles += ( hal_bench[id] - last[id] ) * CYCLES[id];
+		last[id] = hal_bench[id];
+	}
+	return cycles;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	settle
+// @func:	holds a mode's stimulus until the firmware commits it
+// @rtrn:	1 if the mode was reached
+//////////////////////////////////////////////////////////////////////////
+int settle(unsigned char mode) {
+
+	unsigned long i;
+
+	PINB = MODE_STIMULI[mode].pins;
+	hal_vcc = MODE_STIMULI[mode].vcc;
+	for ( i = 0; i < SETTLE_WAKES && mStatus != mode; i++ )
+		hal_wake();
+	return mStatus == mode;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	runCase
+// @func:	from power-on, settles in the start mode, applies the case
+//			and wakes through MODE_STABLE_WAKES + 1 status passes
+//////////////////////////////////////////////////////////////////////////
+void runCase(Case *c) {
+
+	unsigned long i, sleeps, cycles;
+	unsigned char passes = 0;
+
+	MCUSR = (1 << PORF);
+	setup();
+	if ( !settle(c->start) )
+		return;
+
+	PINB = c->pins;
+	voltage = c->volt;
+	hal_vcc = c->volt;
+	watchdogCount = c->wdc;
+	if ( c->start == 7 )
+		probeCount = c->probe ? 1 : probeInterval + 1;
+
+	wakeCycles();	// from here on
+	for ( i = 0; i < STEP_WAKES && passes <= MODE_STABLE_WAKES; i++ ) {
+		sleeps = hal_sleeps;
+		hal_wake();
+		if ( hal_sleeps == sleeps )
+			c->awake++;
+		cycles = wakeCycles();
+		if ( cycles > c->cycles )
+			c->cycles = cycles;
+		if ( tickCount == 0 )
+			passes++;
+	}
+	c->end = passes > MODE_STABLE_WAKES ? mStatus : 0;
+	c->wakes = i;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	checkDimming
+// @func:	sweeps the voltage down in 1mV steps through setBrightness
+//			for each battery mode, the on-pulse must never lengthen as
+//			the cell falls. A solid led, ledPulse 0, is the brightest.
+// @rtrn:	number of steps where it did
+//////////////////////////////////////////////////////////////////////////
+unsigned int checkDimming(void) {
+
+	unsigned int failed = 0, on, last;
+	unsigned short v;
+	unsigned char m;
+
+	for ( m = 4; m <= 7; m++ ) {
+		mStatus = m;
+		last = 256;
+		for ( v = SWEEP_TOP; v >= SWEEP_BOTTOM; v-- ) {
+			passVoltage = v;
+			setBrightness();
+			on = ledPulse ? ledPulse : 256;	// 256 counts is the whole tick
+			if ( on > last ) {
+				printf("FAIL mode %u %u mV: on-pulse %u counts rises from %u\n", m, v, on, last);
+				failed++;
+			}
+			last = on;
+		}
+	}
+	return failed;
+}
+
+
+int main(int argc, char **argv) {
+
+	const unsigned short VOLTS[] = {
+		4150, BATTERY_GOOD, 3360, BATTERY_LOW, 3255, BATTERY_CRITICAL, 3100,
+	};
+	const unsigned char INPUTS = STIM_SWITCH | STIM_CHR | STIM_USB;
+	int verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+	unsigned int nVolts = sizeof(VOLTS) / sizeof(VOLTS[0]);
+	unsigned int total = 0, n, i, failed = 0, awake = 0;
+	unsigned int ends[10] = { 0 };		// end mode bits per start mode
+	unsigned long slowest[10] = { 0 };
+	unsigned long costliest[10][10] = { { 0 } };	// cycles per start, end mode
+	unsigned char m, p, w, probe;
+	unsigned int v;
+	Case *cases;
+	int status;
+
+	cases = mmap(0, 9 * 8 * nVolts * ( START_ADC_1S_WATCHDOG + 1 ) * 2 * sizeof(Case),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( cases == MAP_FAILED ) {
+		perror("mmap");
+		return 1;
+	}
+
+	for ( m = 1; m <= 9; m++ )
+		for ( p = 0; p <= INPUTS; p++ ) {
+			if ( p & ~INPUTS )
+				continue;
+			for ( v = 0; v < nVolts; v++ )
+				for ( w = 0; w <= START_ADC_1S_WATCHDOG; w++ )
+					for ( probe = 0; probe <= ( m == 7 ); probe++ ) {
+						Case *c = &cases[total++];
+						memset(c, 0, sizeof(*c));
+						c->start = m;
+						c->pins = p;
+						c->volt = VOLTS[v];
+						c->wdc = w;
+						c->probe = probe;
+					}
+		}
+
+	// each case in its own process, so main.c starts from power-on
+	fflush(stdout);
+	for ( n = 0; n < total; n++ ) {
+		if ( fork() == 0 ) {
+			runCase(&cases[n]);
+			_exit(0);
+		}
+		wait(&status);
+
+		Case *c = &cases[n];
+		if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+			printf("FAIL start %u pins %02x %u mV wdc %u probe %u: %s\n",
+				c->start, c->pins, c->volt, c->wdc, c->probe,
+				WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT ? "invariant" : "crashed");
+			failed++;
+			continue;
+		}
+		if ( verbose )
+			printf("%u %02x %4u %u %u -> %u %lu %u %lu\n", c->start, c->pins, c->volt,
+				c->wdc, c->probe, c->end, c->wakes, c->awake, c->cycles);
+		if ( c->cycles > TRANSITION_CYCLES ) {
+			printf("FAIL start %u pins %02x %u mV wdc %u probe %u: %lu cycles in one wake\n",
+				c->start, c->pins, c->volt, c->wdc, c->probe, c->cycles);
+			failed++;
+		}
+		if ( c->end == 0 ) {
+			printf("FAIL start %u pins %02x %u mV wdc %u probe %u: %s\n",
+				c->start, c->pins, c->volt, c->wdc, c->probe, "start mode or status passes not reached");
+			failed++;
+		}
+		ends[c->start] |= 1 << c->end;
+		if ( c->wakes > slowest[c->start] )
+			slowest[c->start] = c->wakes;
+		if ( c->cycles > costliest[c->start][c->end] )
+			costliest[c->start][c->end] = c->cycles;
+		awake += c->awake;
+	}
+
+	printf("start  cases  end modes    max wakes\n");
+	for ( m = 1; m <= 9; m++ ) {
+		for ( n = 0, i = 0; i < total; i++ )
+			n += cases[i].start == m;
+		printf("%5u  %5u  ", m, n);
+		for ( i = 1; i <= 9; i++ )
+			putchar( ends[m] & ( 1 << i ) ? '0' + i : '.' );
+		printf("  %9lu\n", slowest[m]);
+	}
+
+	printf("\nmost awake cycles in one wake, start mode down, end mode across\n      ");
+	for ( i = 1; i <= 9; i++ )
+		printf("%6u", i);
+	putchar('\n');
+	for ( m = 1; m <= 9; m++ ) {
+		printf("%5u ", m);
+		for ( i = 1; i <= 9; i++ )
+			if ( ends[m] & ( 1 << i ) )
+				printf("%6lu", costliest[m][i]);
+			else
+				printf("     -");
+		putchar('\n');
+	}
+	printf("budget %lu cycles\n", TRANSITION_CYCLES);
+	printf("%u cases, %u failed, %u wakes without sleep\n", total, failed, awake);
+	n = checkDimming();
+	printf("dimming sweep %u-%u mV, %u steps where the on-pulse rose\n", SWEEP_TOP, SWEEP_BOTTOM, n);
+	failed += n;
+	return failed || awake;
+}
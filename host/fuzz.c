@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	fuzz.c
+// @func:	libFuzzer target for main.c. Each input byte is one event:
+//			an input pin change, a supply change, or a WDT, ADC or
+//			Timer 0 vector followed by loop(). Vectors only run when
+//			the firmware has them enabled and clocked. Besides the
+//			CHECK_INVARIANTS rules it aborts on a loop() that returns
+//			without sleeping, an ADC burst that re-arms more than
+//			ADC_BURST_MAX times, more than one led pulse armed per
+//			watchdog tick, and a pulse armed with no length, which
+//			would light the leds for the whole tick. Every input
+//			starts from power-on.
+//			With FUZZ_MAIN defined it builds with any C compiler and
+//			runs files or seeded random inputs instead.
+//			usage: fuzz [runs] | fuzz file...
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+#include "stimuli.h"
+
+const unsigned long ADC_BURST_MAX = 11;	// ADC_vect restarts 10 times, then stops
+const unsigned int PULSES_PER_TICK = 1;	// pulseLeds arms one per watchdog tick
+const unsigned int FUZZ_LEN = 256;		// random input length, FUZZ_MAIN
+
+// Event, the top 3 bits of a byte, the low 5 are its argument
+#define EV_PINS		0	// PINB = arg, input bits only
+#define EV_VCC		1	// hal_vcc = 2900 + 45 mV x arg
+#define EV_WDT		2	// WDT_vect()
+#define EV_ADC		3	// finish a pending conversion, ADC_vect()
+#define EV_TIM0_OVF	4	// TIM0_OVF_vect()
+#define EV_TIM0_COMPA 5	// TIM0_COMPA_vect()
+#define EV_TIM0_COMPB 6	// TIM0_COMPB_vect()
+#define EV_WAKE		7	// hal_wake(), a whole watchdog wake
+
+static unsigned long burst;		// conversions since the ADC was enabled
+static unsigned int pulses;		// pulses armed since the last tick
+static size_t event;			// input position, for the report
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	fail
+// @func:	reports a broken rule and aborts, as an assert would
+//////////////////////////////////////////////////////////////////////////
+static void fail(const char *what) {
+
+	fprintf(stderr, "fuzz: %s at event %lu\n", what, (unsigned long)event);
+	abort();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	timerRunning
+// @func:	1 if Timer 0 is clocked and the interrupt in mask can fire
+//////////////////////////////////////////////////////////////////////////
+static int timerRunning(unsigned char mask) {
+
+	return ( TIMSK & mask ) && ( TCCR0B & 0x07 ) && !( PRR & (1 << PRTIM0) );
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	runLoop
+// @func:	loop() after a vector, which must end in a sleep
+//////////////////////////////////////////////////////////////////////////
+static void runLoop(void) {
+
+	unsigned long sleeps = hal_sleeps;
+
+	loop();
+	if ( hal_sleeps == sleeps )
+		fail("loop() returned without sleeping");
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+	unsigned long conversions;
+	unsigned char armed, arg;
+
+	hal_reset(1 << PORF);
+	PINB = 0;
+	hal_vcc = 4000;
+	setup();
+	burst = 0;
+	pulses = 0;
+
+	for ( event = 0; event < size; event++ ) {
+		arg = data[event] & 0x1F;
+		conversions = hal_adc_conversions;
+		armed = TIMSK & (1 << OCIE0B);
+
+		switch ( data[event] >> 5 ) {
+		case EV_PINS:
+			PINB = arg & ( STIM_SWITCH | STIM_CHR | STIM_USB );
+			break;
+		case EV_VCC:
+			hal_vcc = 2900 + 45 * arg;
+			break;
+		case EV_WDT:
+			pulses = 0;
+			WDT_vect();
+			runLoop();
+			break;
+		case EV_ADC:
+			if ( hal_adc_service() )
+				runLoop();
+			break;
+		case EV_TIM0_OVF:
+			if ( timerRunning(1 << TOIE0) ) {
+				TIM0_OVF_vect();
+				runLoop();
+			}
+			break;
+		case EV_TIM0_COMPA:
+			if ( timerRunning(1 << OCIE0A) ) {
+				TIM0_COMPA_vect();
+				runLoop();
+			}
+			break;
+		case EV_TIM0_COMPB:
+			if ( timerRunning(1 << OCIE0B) ) {
+				TIM0_COMPB_vect();
+				runLoop();
+			}
+			break;
+		case EV_WAKE:
+			pulses = 0;
+			hal_wake();	// checks its own loop() calls through the invariants
+			break;
+		}
+
+		burst += hal_adc_conversions - conversions;
+		if ( burst > ADC_BURST_MAX )
+			fail("ADC burst re-armed past ADC_BURST_MAX");
+		if ( !( ADCSRA & (1 << ADEN) ) )
+			burst = 0;
+		if ( !armed && ( TIMSK & (1 << OCIE0B) ) && ++pulses > PULSES_PER_TICK )
+			fail("led pulse re-armed within one watchdog tick");
+		if ( !armed && ( TIMSK & (1 << OCIE0B) ) && OCR0B == 0 )
+			fail("led pulse armed with OCR0B 0");
+	}
+	return 0;
+}
+
+
+#ifdef FUZZ_MAIN
+//////////////////////////////////////////////////////////////////////////
+// @name:	runFile
+// @func:	one input read from a file, such as a saved libFuzzer crash
+//////////////////////////////////////////////////////////////////////////
+static int runFile(const char *name) {
+
+	static uint8_t data[65536];
+	size_t size;
+	FILE *f = fopen(name, "rb");
+
+	if ( !f ) {
+		perror(name);
+		return 1;
+	}
+	size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	LLVMFuzzerTestOneInput(data, size);
+	return 0;
+}
+
+
+int main(int argc, char **argv) {
+
+	static uint8_t data[256];
+	unsigned long runs, i;
+	unsigned long seed = 1;	// fixed, so a failing run repeats
+	unsigned int len, j;
+
+	if ( argc > 1 && ( argv[1][0] < '0' || argv[1][0] > '9' ) ) {
+		for ( i = 1; i < (unsigned long)argc; i++ )
+			if ( runFile(argv[i]) )
+				return 1;
+		printf("%d inputs passed\n", argc - 1);
+		return 0;
+	}
+
+	runs = argc > 1 ? strtoul(argv[1], 0, 0) : 100000UL;
+	for ( i = 0; i < runs; i++ ) {
+		seed = seed * 1103515245UL + 12345UL;
+		len = ( seed >> 16 ) % FUZZ_LEN + 1;
+		for ( j = 0; j < len; j++ ) {
+			seed = seed * 1103515245UL + 12345UL;
+			data[j] = seed >> 16;
+		}
+		LLVMFuzzerTestOneInput(data, len);
+	}
+	printf("%lu inputs, %lu sleeps, %lu conversions, no rule broken\n",
+		runs, hal_sleeps, hal_adc_conversions);
+	return 0;
+}
+#endif // FUZZ_MAIN
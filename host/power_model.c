@@ -0,0 +1,178 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	power_model.c
+// @func:	costs each host wake of main.c in supply charge, see
+//			power_model.h for the figures it applies
+//////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "hal.h"
+#include "power_model.h"
+
+extern unsigned char mStatus;
+extern unsigned char tickCount;
+extern unsigned char bodsSupported;
+extern unsigned char sleepBods;
+extern volatile unsigned char grn_glw;
+
+#define LED_BITS	( (1 << PB0) | (1 << PB2) )	// red, green, active low
+
+static unsigned long lastConversions;	// hal_adc_conversions at last wake
+static unsigned char lastMode;			// mStatus at last wake
+static unsigned int pulses;				// led pulses this wake
+static unsigned long pulseCounts;		// their length in 64us counts
+static unsigned long pulseLedCounts;	// length x leds lit
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	ledsLit
+// @func:	number of leds in a PORTB/DDRB bit set
+//////////////////////////////////////////////////////////////////////////
+static int ledsLit(unsigned char bits) {
+
+	return ( (bits >> PB0) & 1 ) + ( (bits >> PB2) & 1 );
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	pulseEnded
+// @func:	hal_pulse_hook, records a pulse just before TIM0_COMPB_vect
+//			turns its leds off
+//////////////////////////////////////////////////////////////////////////
+static void pulseEnded(void) {
+
+	pulses++;
+	pulseCounts += OCR0B;
+	pulseLedCounts += (unsigned long)OCR0B * ledsLit(~PORTB & DDRB & LED_BITS);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	powerStart
+// @func:	clears the totals and hooks led pulses, call after setup()
+//////////////////////////////////////////////////////////////////////////
+void powerStart(PowerTotals *t) {
+
+	memset(t, 0, sizeof(*t));
+	lastConversions = hal_adc_conversions;
+	lastMode = mStatus;
+	pulses = 0;
+	pulseCounts = 0;
+	pulseLedCounts = 0;
+	hal_pulse_hook = pulseEnded;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	powerWake
+// @func:	costs the wake just run by hal_wake() and the sleep that
+//			follows it, up to the next watchdog wake
+//////////////////////////////////////////////////////////////////////////
+void powerWake(PowerTotals *t) {
+
+	static const unsigned int TIM0_PRESCALE[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	int mode = ( mStatus >= 1 && mStatus <= 9 ) ? mStatus : 0;
+	int fast = ( CLKPR == 3 );	// clock the chip sleeps at
+	double period = hal_wdt_ms() / 1000.0;
+	unsigned long conv = hal_adc_conversions - lastConversions;
+	unsigned int prescale = TIM0_PRESCALE[TCCR0B & 0x07];
+	unsigned char solid = ~PORTB & DDRB & LED_BITS;
+	double awakeFast = 0, awakeSlow = CYC_WAKE / 125e3;
+	double adcTime = 0, pulseTime = pulseCounts * 64e-6;
+	double isrAwake = 0, rest, chip, ledTime = 0;
+	int bodOff = 0;
+
+	if ( tickCount == 0 )		// this wake ran a status pass
+		awakeFast += CYC_STATUS / 1e6;
+	if ( mStatus != lastMode )
+		awakeFast += CYC_SETMODE / 1e6;
+	if ( conv ) {
+		awakeSlow += conv * CYC_ADC_SAMPLE / 125e3;
+		adcTime = ( ADC_FIRST_CLKS + ( conv - 1 ) * ADC_CLKS ) / ADC_HZ;
+	}
+	awakeSlow += pulses * CYC_PULSE / 125e3;
+
+	// Timer 0 still clocked after the wake is a glow, it runs all period
+	if ( prescale && ( TIMSK & ( (1 << OCIE0A) | (1 << TOIE0) ) ) ) {
+		isrAwake = period / ( prescale * 256.0 ) * CYC_TIM0_ISR;	// share of the period in the ISRs
+		if ( TIMSK & (1 << OCIE0A) && TIMSK & (1 << TOIE0) )
+			isrAwake *= 2;
+	}
+
+	chip = awakeFast * UA_ACTIVE_1MHZ + awakeSlow * UA_ACTIVE_125K
+		+ adcTime * ( UA_ADC + UA_IDLE_125K ) + pulseTime * UA_IDLE_125K
+		+ isrAwake * ( fast ? UA_ACTIVE_1MHZ : UA_ACTIVE_125K );
+	rest = period - awakeFast - awakeSlow - adcTime - pulseTime - isrAwake;
+	if ( rest < 0 )
+		rest = 0;
+	if ( ( MCUCR & (1 << SM1) ) && !prescale ) {
+		chip += rest * UA_POWER_DOWN;
+		bodOff = bodsSupported && sleepBods;
+	}
+	else
+		chip += rest * ( fast ? UA_IDLE_1MHZ : UA_IDLE_125K );
+	chip += ( period - ( bodOff ? rest : 0 ) ) * UA_BOD;
+
+	// leds, solid for the period, PWM at the glow duty, pulses as run
+	if ( TCCR0A & (1 << COM0A1) ) {	// red on OC0A, low until OCR0A
+		solid &= ~(1 << PB0);
+		ledTime += period * ( OCR0A + 1 ) / 256.0;
+	}
+	if ( grn_glw ) {				// green on OVF, off at OCR0A
+		solid &= ~(1 << PB2);
+		ledTime += period * OCR0A / 256.0;
+	}
+	ledTime += period * ledsLit(solid) + pulseLedCounts * 64e-6;
+
+	t->seconds[mode] += period;
+	t->awake[mode] += awakeFast + awakeSlow + isrAwake;
+	t->chipUc[mode] += chip;
+	t->ledUc[mode] += ledTime * UA_LED;
+	t->wakes[mode]++;
+
+	lastConversions = hal_adc_conversions;
+	lastMode = mStatus;
+	pulses = 0;
+	pulseCounts = 0;
+	pulseLedCounts = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	powerChipUa, powerLedUa
+// @func:	average chip or led current over the time spent in a mode
+// @rtrn:	uA, 0 if the mode never ran
+//////////////////////////////////////////////////////////////////////////
+double powerChipUa(const PowerTotals *t, int mode) {
+
+	return t->seconds[mode] > 0 ? t->chipUc[mode] / t->seconds[mode] : 0;
+}
+
+double powerLedUa(const PowerTotals *t, int mode) {
+
+	return t->seconds[mode] > 0 ? t->ledUc[mode] / t->seconds[mode] : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	powerTotalSeconds, powerTotalUc
+// @func:	time and chip charge summed over all modes
+//////////////////////////////////////////////////////////////////////////
+double powerTotalSeconds(const PowerTotals *t) {
+
+	double s = 0;
+	int i;
+
+	for ( i = 0; i < 10; i++ )
+		s += t->seconds[i];
+	return s;
+}
+
+double powerTotalUc(const PowerTotals *t) {
+
+	double uc = 0;
+	int i;
+
+	for ( i = 0; i < 10; i++ )
+		uc += t->chipUc[i];
+	return uc;
+}
@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	power_model.h
+// @func:	Average current estimate for host runs of main.c. Each wake
+//			is costed from the registers and hal counters it leaves
+//			behind, using ATtiny45 datasheet currents and per-section
+//			cycle counts. Totals are kept per mode.
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef POWER_MODEL_H
+#define POWER_MODEL_H
+
+// Supply currents in uA, typical at about 3.7V and 25C
+#define UA_POWER_DOWN	4.0		// power down, watchdog on
+#define UA_BOD			20.0	// brown-out detector, fused on
+#define UA_ACTIVE_1MHZ	500.0	// running at CLOCK_FAST
+#define UA_ACTIVE_125K	100.0	// running at CLOCK_SLOW, RC oscillator dominated
+#define UA_IDLE_1MHZ	120.0	// idle at CLOCK_FAST
+#define UA_IDLE_125K	50.0	// idle at CLOCK_SLOW
+#define UA_ADC			200.0	// ADC and bandgap while converting
+#define UA_LED			2000.0	// one lit led, set by the board resistors
+
+// Cycles per section. Defaults, replace them with counts measured
+// through the BENCH markers when a change moves them.
+#define CYC_WAKE		60		// WDT_vect, an empty loop() and sleep entry
+#define CYC_STATUS		450		// getStatus() pass with debounce and saveState
+#define CYC_SETMODE		250		// setMode()
+#define CYC_ADC_SAMPLE	700		// ADC_vect, mostly the 32 bit division
+#define CYC_PULSE		40		// pulseLeds() and TIM0_COMPB_vect
+#define CYC_TIM0_ISR	25		// TIM0_OVF_vect or TIM0_COMPA_vect
+#define CYC_SEQUENCE	60		// stepSequence(), one tick inside WDT_vect
+
+// ADC timing at CLOCK_SLOW / 2
+#define ADC_HZ			62500.0
+#define ADC_FIRST_CLKS	25		// first conversion after ADEN
+#define ADC_CLKS		13
+
+typedef struct {
+	double seconds[10];		// simulated time per mode, index 0 unused
+	double awake[10];		// cpu running time per mode
+	double chipUc[10];		// chip charge per mode in uC
+	double ledUc[10];		// led charge per mode in uC
+	unsigned long wakes[10];
+} PowerTotals;
+
+void powerStart(PowerTotals *t);
+void powerWake(PowerTotals *t);
+double powerChipUa(const PowerTotals *t, int mode);
+double powerLedUa(const PowerTotals *t, int mode);
+double powerTotalSeconds(const PowerTotals *t);
+double powerTotalUc(const PowerTotals *t);
+
+#endif // POWER_MODEL_H
@@ -0,0 +1,106 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	scenario.c
+// @func:	host driver that discharges the modelled Li-ion cell from
+//			full under each load profile, switch on and no USB, and
+//			reports runtime to mode 7 cutoff, mode changes and the
+//			firmware's own charge use. Each profile runs in its own
+//			process, so main.c starts from power-on globals.
+//			usage: scenario [capacity mAh]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "stimuli.h"
+#include "power_model.h"
+
+extern unsigned char mStatus;
+
+const double LIMIT_S = 3600.0 * 2000;	// give up after this much time
+
+typedef struct {
+	const char *name;
+	unsigned int highMa;	// load for the first highS of each period
+	unsigned int lowMa;		// load for the rest
+	double highS;
+	double periodS;
+} Profile;
+
+const Profile PROFILES[] = {
+	{ "constant 2A", 2000, 2000, 1, 1 },
+	{ "pulsed 2A 1s/10s", 2000, 100, 1, 10 },
+	{ "idle 5mA", 5, 5, 1, 1 },
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	loadMa
+// @func:	profile load at a point in time, 0 once the output is cut
+//////////////////////////////////////////////////////////////////////////
+unsigned int loadMa(const Profile *p, double t) {
+	
+	if ( DDRB & (1 << PB1) )	// OUT_ENA held low, 3.3V off
+		return 0;
+	return ( t - (long)( t / p->periodS ) * p->periodS ) < p->highS ? p->highMa : p->lowMa;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	runProfile
+// @func:	discharges from full until mode 7 or LIMIT_S
+//////////////////////////////////////////////////////////////////////////
+void runProfile(const Profile *p, double capacityMah) {
+	
+	PowerTotals totals;
+	double t = 0, dt;
+	double charge = capacityMah * 3600.0;	// mAs left
+	double chipUc = 0;
+	unsigned int soc = 1000, load = 0;
+	unsigned long transitions = 0, wakes = 0, conversions = hal_adc_conversions;
+	unsigned char last;
+	
+	PINB = MODE_STIMULI[4].pins;	// switch on, no USB
+	hal_vcc = hal_cell_mv(soc, 0);
+	setup();
+	powerStart(&totals);
+	last = mStatus;
+	while ( mStatus != 7 && t < LIMIT_S ) {
+		hal_vcc = hal_cell_mv(soc, load);
+		hal_wake();
+		powerWake(&totals);
+		wakes++;
+		if ( mStatus != last ) {
+			transitions++;
+			last = mStatus;
+		}
+		dt = hal_wdt_ms() / 1000.0;
+		load = loadMa(p, t);
+		chipUc = powerTotalUc(&totals);
+		charge -= load * dt;
+		t += dt;
+		soc = charge > 0 ? (unsigned int)( charge * 1000 / ( capacityMah * 3600.0 ) ) : 0;
+	}
+	printf("%-18s %9.0f s %7.2f h %5lu %9lu %9lu %8.3f\n", p->name, t, t / 3600,
+		transitions, wakes, hal_adc_conversions - conversions, chipUc / 3600.0 / 1000.0);
+}
+
+
+int main(int argc, char **argv) {
+	
+	double capacity = argc > 1 ? atof(argv[1]) : 2500.0;
+	unsigned int i;
+	
+	printf("%.0f mAh cell, time to mode 7 cutoff\n", capacity);
+	printf("profile            runtime             modes     wakes  adc conv  fw mAh\n");
+	fflush(stdout);
+	for ( i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++ ) {
+		if ( fork() == 0 ) {	// fresh firmware RAM, as at power-on
+			runProfile(&PROFILES[i], capacity);
+			exit(0);
+		}
+		wait(0);
+	}
+	return 0;
+}
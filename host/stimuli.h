@@ -0,0 +1,36 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	stimuli.h
+// @func:	PINB levels and supply that hold each of the nine modes,
+//			shared by the host drivers and the simavr harness
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef STIMULI_H
+#define STIMULI_H
+
+// PINB bits, as main.c names them
+#define STIM_SWITCH	0x02	// PB1 OUT_ENA, switch on
+#define STIM_CHR	0x08	// PB3 CHR_STA, high unless charging
+#define STIM_USB	0x10	// PB4 USB_STA, USB connected
+
+typedef struct {
+	unsigned char pins;		// PINB levels
+	unsigned int vcc;		// supply in mV
+	const char *name;
+} Stimulus;
+
+// Index is the mode, 0 unused. Supplies sit mid band between the
+// BATTERY_* thresholds, mode 7 is reached through mode 6 by the ADC.
+static const Stimulus MODE_STIMULI[10] = {
+	{ 0, 0, "" },
+	{ STIM_CHR, 3800, "off" },
+	{ STIM_USB, 3800, "off, charging" },
+	{ STIM_USB | STIM_CHR, 4150, "off, charged" },
+	{ STIM_SWITCH | STIM_CHR, 3900, "on, good" },
+	{ STIM_SWITCH | STIM_CHR, 3360, "on, low" },
+	{ STIM_SWITCH | STIM_CHR, 3255, "on, critical" },
+	{ STIM_SWITCH | STIM_CHR, 3100, "cutoff" },
+	{ STIM_SWITCH | STIM_USB, 3800, "on, charging" },
+	{ STIM_SWITCH | STIM_USB | STIM_CHR, 4150, "on, charged" },
+};
+
+#endif // STIMULI_H
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	timeline.c
+// @func:	host driver that replays a field trace, see hal_replay, and
+//			prints one line per watchdog wake: the wake time in ms, the
+//			inputs, the mode after it, the led states, and the ADC
+//			conversions and sleeps it took. Two firmware builds print
+//			the same lines until their behaviour parts, so diff shows
+//			the first wake that changed. sim/timeline prints the same
+//			first five columns from simavr. Without a trace each mode's
+//			stimulus is held for HOLD_MS in turn.
+//			usage: timeline [trace]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "stimuli.h"
+
+extern unsigned char mStatus;
+
+const unsigned long HOLD_MS = 30000;	// per mode, default trace
+
+static unsigned long conversions;	// hal_adc_conversions at the last wake
+static unsigned long sleeps;		// hal_sleeps at the last wake
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	ledChar
+// @func:	state of one led: '-' pin not driven, '1' lit, '0' dark,
+//			'~' driven by Timer 0 between wakes
+//////////////////////////////////////////////////////////////////////////
+static char ledChar(unsigned char pin, unsigned char timer) {
+
+	if ( !( DDRB & (1 << pin) ) )
+		return '-';
+	if ( timer )
+		return '~';
+	return ( PORTB & (1 << pin) ) ? '0' : '1';	// low lights the led
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	printWake
+// @func:	hal_replay callback, one line per wake
+//////////////////////////////////////////////////////////////////////////
+static void printWake(void) {
+
+	printf("%8lu %02x %4u %u %c%c %4lu %4lu\n", hal_ms, PINB, hal_vcc, mStatus,
+		ledChar(PB0, TCCR0A & (1 << COM0A1)),
+		ledChar(PB2, TIMSK & ( (1 << OCIE0A) | (1 << TOIE0) )),
+		hal_adc_conversions - conversions, hal_sleeps - sleeps);
+	conversions = hal_adc_conversions;
+	sleeps = hal_sleeps;
+}
+
+
+int main(int argc, char **argv) {
+
+	TraceRecord *trace;
+	unsigned int count;
+	unsigned char mode;
+
+	if ( argc > 1 ) {
+		trace = hal_trace_load(argv[1], &count);
+		if ( !trace )
+			return 1;
+	}
+	else {
+		// last record holds mode 9 for its HOLD_MS
+		count = 10;
+		trace = malloc(count * sizeof(*trace));
+		for ( mode = 1; mode <= count; mode++ ) {
+			trace[mode - 1].ms = ( mode - 1 ) * HOLD_MS;
+			trace[mode - 1].pins = MODE_STIMULI[mode < 9 ? mode : 9].pins;
+			trace[mode - 1].vcc = MODE_STIMULI[mode < 9 ? mode : 9].vcc;
+		}
+	}
+
+	printf("# ms, PINB, mV, mode, red and green led, conversions, sleeps\n");
+	setup();
+	hal_replay(trace, count, printWake);
+	free(trace);
+	return 0;
+}
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	wakerate.c
+// @func:	host driver that cycles main.c through all nine modes and
+//			reports simulated watchdog wakes per second of host time
+//			usage: wakerate [wakes]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hal.h"
+#include "stimuli.h"
+
+extern unsigned char mStatus;
+
+const unsigned long WAKES_PER_MODE = 1000;	// wakes before the next stimulus
+
+
+int main(int argc, char **argv) {
+	
+	unsigned long wakes = argc > 1 ? strtoul(argv[1], 0, 0) : 10000000UL;
+	unsigned long i;
+	unsigned long seen = 0;		// bit per mode reached
+	unsigned char mode = 1;
+	clock_t start;
+	double secs;
+	
+	setup();
+	start = clock();
+	for ( i = 0; i < wakes; i++ ) {
+		if ( i % WAKES_PER_MODE == 0 ) {
+			mode = mode % 9 + 1;
+			PINB = MODE_STIMULI[mode].pins;
+			hal_vcc = MODE_STIMULI[mode].vcc;
+		}
+		hal_wake();
+		seen |= 1UL << mStatus;
+	}
+	secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	
+	printf("%lu wakes, %lu sleeps, %lu conversions in %.3f s: %.0f wakes/s\n",
+		wakes, hal_sleeps, hal_adc_conversions, secs, secs > 0 ? wakes / secs : 0);
+	if ( wakes >= 9 * WAKES_PER_MODE && seen != 0x3FE ) {
+		printf("modes reached %03lx, expected all of 1-9\n", seen);
+		return 1;
+	}
+	return 0;
+}
@@ -6,13 +6,13 @@
 //				consumption.
 //////////////////////////////////////////////////////////////////////////
 
-#define F_CPU 1000000UL	// speed of clock after prescaler (8MHz/8)
+#define F_CPU 1000000UL	// speed of clock after prescaler (8MHz/8), CLOCK_FAST.
+						// Idles at CLOCK_SLOW but in mode 8, delays only valid when fast
+//#define PULSED_SOLID		// solid leds flash once per 16ms tick instead
+//#define SIGMA_DELTA_GLOW	// mode 8 glows by sigma-delta, no Timer 0 interrupts
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <util/delay.h>
-#include <avr/sleep.h>
-#include <avr/wdt.h>
+#include <stddef.h>
+#include "hal.h"
 
 // Pins
 #define LED_RED	PB0		// LOW enables Red LED
@@ -21,22 +21,120 @@
 #define CHR_STA	PB3		// LOW input means Li-Ion is charging
 #define USB_STA	PB4		// HIGH input means USB connected
 
+// Pin Policy, lowest leakage state of each pin per mode. Led pins are
+// never left floating, unread pins have their input buffer off (DIDR0).
+//	mode	PB0 red		PB1 out_ena	PB2 green	PB3 chr_sta	PB4 usb_sta
+//	1		out high	in, switch	out high	in, sampled	in, usb
+//	2		OC0A pwm	in, switch	out high	in, sampled	in, usb
+//	3		out low		in, switch	out high	in, sampled	in, usb
+//	4		out high	in, switch	out low		in, sampled	in, usb
+//	5, 6	sequenced	in, switch	sequenced	in, sampled	in, usb
+//	7		out high	out low		out high	in, sampled	in, usb
+//	8		out high	in, switch	sequenced	in, sampled	in, usb
+//	9		out high	in, switch	out low		in, sampled	in, usb
+// PB0, PB2 digital input off, output state only. PB1, PB4 are
+// driven by the switch and USB sense circuits, a pull-up would fight them.
+// PB3 is open drain from the charger. Whether STAT floats or clamps to
+// the charger's VCC while it is unpowered is not known for this board,
+// so its pull-up and input buffer are only on while readInputs samples
+// it. The rest of the time PB3 floats with its input buffer off.
+// PB5 is RESET with its own pull-up and its digital input off.
+
 // ADC Conversion Variables
 const unsigned char START_ADC_1S_WATCHDOG = 4;
-const unsigned char START_ADC_0_5S_WATCHDOG = 8;
 unsigned char watchdogCount = 0; // number of watchdog calls before new adc sample
 unsigned short adcVal;
-unsigned int sumVolt;
-unsigned short voltage = 4000;
-unsigned char numSamples = 0;	 // number of adc samples
+volatile unsigned short sumVolt; // 16 bits on the AVR and host alike
+volatile unsigned short voltage = 4000;
+unsigned short passVoltage = 4000; // voltage, read once per status pass
+volatile unsigned char numSamples = 0; // number of adc samples
+
+// Cutoff Probe Variables
+const unsigned char PROBE_BACKOFF_MAX = 8; // max watchdog calls between switch probes
+unsigned char probeInterval = 1; // watchdog calls between switch probes in mode 7
+unsigned char probeCount = 1;	 // watchdog calls until next switch probe
+#ifdef CHECK_INVARIANTS
+unsigned char checkPins = 0;	 // inputs seen by the last status pass
+#endif
 
 // PWM Variables
-const unsigned char PWM_RAMP_SPEED = 3;
-const unsigned char PWM_MAX = 253;
-const unsigned char PWM_MIN = 0;
-unsigned char countPWM = 0;
-char indexDirPWM = 1;
-unsigned char indexPWM = 70;
+const unsigned char PWM_PHASES = 128;	// one breath, up then down the table
+unsigned char phasePWM = 0;
+unsigned char glowLevel = 0;	// current breath duty, 0-255
+
+// Sequencer Opcodes, operand in the low 6 bits
+#define SEQ_SET(leds)	(0x00 | (leds))	// set led outputs
+#define SEQ_HOLD(n)		(0x40 | (n))	// hold n ticks, 0 = forever
+#define SEQ_RAMP(n)		(0x80 | (n))	// step the glow n ticks, 0 = forever
+#define SEQ_LOOP(n)		(0xC0 | (n))	// jump back n opcodes, 0 = to start
+#define SEQ_OP			0xC0
+#define SEQ_ARG			0x3F
+#define SEQ_RED			0x01	// SEQ_SET operand, red on
+#define SEQ_GRN			0x02	// SEQ_SET operand, green on
+#define SEQ_GRN_PWM		0x04	// SEQ_SET operand, green on Timer 0 PWM
+#define SEQ_RED_SD		0x08	// SEQ_SET operand, red on sigma-delta
+#define SEQ_GRN_SD		0x10	// SEQ_SET operand, green on sigma-delta
+
+// Indicator Programs, every loop must hold or ramp at least one tick
+const unsigned char SEQ_GLOW[] PROGMEM = {	// glow whichever led the PWM drives
+	SEQ_RAMP(0)
+};
+const unsigned char SEQ_GLOW_GRN[] PROGMEM = {
+	SEQ_SET(SEQ_GRN_PWM), SEQ_RAMP(0)
+};
+const unsigned char SEQ_GLOW_GRN_SD[] PROGMEM = {	// flickers, but no Timer 0
+	SEQ_SET(SEQ_GRN_SD), SEQ_RAMP(0)
+};
+const unsigned char SEQ_LOW[] PROGMEM = {		// green, red flash every second
+	SEQ_SET(SEQ_GRN | SEQ_RED), SEQ_HOLD(8), SEQ_SET(SEQ_GRN), SEQ_HOLD(56), SEQ_LOOP(0)
+};
+const unsigned char SEQ_SOLID_RED[] PROGMEM = {
+	SEQ_SET(SEQ_RED), SEQ_HOLD(0)
+};
+const unsigned char SEQ_SOLID_GRN[] PROGMEM = {
+	SEQ_SET(SEQ_GRN), SEQ_HOLD(0)
+};
+const unsigned char SEQ_CRITICAL[] PROGMEM = {	// green, red flash every 1/2 second
+	SEQ_SET(SEQ_GRN | SEQ_RED), SEQ_HOLD(8), SEQ_SET(SEQ_GRN), SEQ_HOLD(24), SEQ_LOOP(0)
+};
+
+// Sequencer Variables
+const unsigned char *seqProgram = 0; // running program, 0 = leds set by setMode
+unsigned char seqPc = 0;		// next opcode
+unsigned char seqWait = 0;		// ticks left in the current hold or ramp
+unsigned char seqRamp = 0;		// 1 = current wait steps the glow
+unsigned char sdMask = 0;		// PORTB bits of the sigma-delta leds
+unsigned char sdAcc = 0;		// sigma-delta accumulator
+
+// Brightness Governor Variables
+#ifdef PULSED_SOLID
+const unsigned char PULSE_SOLID = 47;	// full brightness on-pulse, 3ms
+const unsigned char PULSE_SHIFT = 3;	// mV per count = 8, dims up to 2.4ms
+#else
+const unsigned char PULSE_SOLID = 0;	// full brightness is solid
+const unsigned char PULSE_SHIFT = 2;	// mV per count = 4, dims up to 4.1ms
+#endif
+const unsigned char PULSE_MIN = 12;	// shortest on-pulse, 0.8ms
+unsigned char ledPulse = 0;		// on-pulse per 16ms tick in 64us Timer 0 counts, 0 = solid leds
+volatile unsigned char pulseMask = 0;	// PORTB bits of the leds to pulse
+volatile unsigned char requestPulse = 0;	// 1 calls pulseLeds
+
+// Watchdog Tick Variables
+const unsigned char TICKS_16MS_1S = 64;	// 16ms ramp ticks per status check
+volatile unsigned char ticksPerStatus = 1;	// watchdog calls per getStatus
+unsigned char tickCount = 0;		// watchdog calls since last getStatus
+
+// Breathing curve, 253 * (i/63)^2.2 gamma so the glow looks linear to
+// the eye. Tops out at 253, as the old linear ramp did: at OCR0A = 255
+// TIM0_OVF_vect and TIM0_COMPA_vect fire on the same count and green
+// goes dark for the whole period. Averages 31% duty where a linear
+// ramp averages 50%.
+const unsigned char BREATH[64] PROGMEM = {
+	  0,   0,   0,   0,   1,   1,   1,   2,   3,   3,   4,   5,   7,   8,   9,  11,
+	 12,  14,  16,  18,  20,  23,  25,  28,  30,  33,  36,  39,  42,  46,  49,  53,
+	 57,  61,  65,  69,  74,  78,  83,  88,  93,  98, 104, 109, 115, 121, 127, 133,
+	139, 146, 152, 159, 166, 173, 180, 188, 195, 203, 211, 219, 227, 236, 244, 253
+};
 
 // Status Variables
 const unsigned short BATTERY_GOOD = 3419; // min good voltage = 3.5V
@@ -44,24 +142,127 @@ const unsigned short BATTERY_LOW = 3304; // min low voltage = 3.4V
 const unsigned short BATTERY_CRITICAL = 3209; // min critical voltage = 3.3V
 unsigned char mStatus;			// 1-9 status indicator
 unsigned char pStatus = 0;		// 1-9 previous status indicator
-unsigned char grn_glw = 0;		// 1 = green led glows
-unsigned char red_glw = 0;		// 1 = red led glows
-unsigned char requestStatus = 1;// 1 calls getStatus
+volatile unsigned char grn_glw = 0;	// 1 = green led glows
+volatile unsigned char requestStatus = 1;// 1 calls getStatus
+
+// Clock Variables, CLKPR prescaler of the 8MHz RC oscillator
+const unsigned char CLOCK_FAST = 3;	// 8MHz/8 = 1MHz for status computation
+const unsigned char CLOCK_SLOW = 6;	// 8MHz/64 = 125kHz while peripherals run
+unsigned char idleClock = 6;		// CLOCK_SLOW, or CLOCK_FAST while mode 8 glows
+
+// Sleep Variables
+unsigned char bodsSupported = 0;	// 1 = silicon has BODS, rev C and later
+unsigned char sleepBods = 0;		// 1 = mode turns BOD off in power down
+
+// Debounce Variables
+const unsigned char MODE_STABLE_WAKES = 2; // wakes a new mode must hold before commit
+unsigned char cStatus = 0;		// 1-9 candidate status awaiting confirmation
+unsigned char stableCount = 0;	// consecutive wakes cStatus has been seen
+
+// Reset-Surviving State
+typedef struct {
+	unsigned char mode;				// last committed mStatus
+	unsigned short voltage;			// last averaged voltage
+	unsigned char watchdogCount;	// adc schedule position
+	unsigned char probeInterval;	// mode 7 probe back-off
+	unsigned char check;			// checksum of the fields above
+} SavedState;
+SavedState saved HAL_NOINIT; // not cleared on reset
+
+#ifdef MODE_TRACE
+// Mode Trace, the last MODE_TRACE_LEN setMode calls in .noinit RAM for
+// a debugger or simavr to read. setup() writes mode 0 to mark a reset.
+// An entry is three lds/st pairs, 12 cycles, and loading, stepping,
+// wrapping and storing traceNext takes about 13 more.
+#define MODE_TRACE_LEN	8	// entries
+typedef struct {
+	unsigned char tick;		// status checks since reset, wraps at 256
+	unsigned char mode;		// mode set, 0 marks a reset
+	unsigned char adc;		// low byte of the last ADC result, see README
+} TraceEntry;
+TraceEntry modeTrace[MODE_TRACE_LEN] HAL_NOINIT;
+TraceEntry *traceNext HAL_NOINIT;	// entry the next setMode writes
+unsigned char traceTick = 0;		// status checks since reset
+#endif
 
+#ifdef SIMAVR
+// simavr reads this from the elf and writes trace.vcd for GTKWave.
+// PB0-PB4 are traced at the pin, so the red led shows the OC0A PWM
+// and PB1 shows both the switch and the mode 7 cutoff driving it low.
+// The IRQ traces mark each vector from entry to reti. The rest are
+// register writes: PB1_HELD is the cutoff, SE marks sleep, SM1 picks
+// power down over idle, GPIOR0 carries the BENCH section markers.
+AVR_MCU(F_CPU, "attiny45");
+AVR_MCU_VCD_FILE("trace.vcd", 1000);
+AVR_MCU_VCD_PORT_PIN('B', PB0, "PB0_RED");
+AVR_MCU_VCD_PORT_PIN('B', PB1, "PB1_OUT_ENA");
+AVR_MCU_VCD_PORT_PIN('B', PB2, "PB2_GRN");
+AVR_MCU_VCD_PORT_PIN('B', PB3, "PB3_CHR_STA");
+AVR_MCU_VCD_PORT_PIN('B', PB4, "PB4_USB_STA");
+AVR_MCU_VCD_IRQ(WDT);
+AVR_MCU_VCD_IRQ(ADC);
+AVR_MCU_VCD_IRQ(TIM0_OVF);
+AVR_MCU_VCD_IRQ(TIM0_COMPA);
+AVR_MCU_VCD_IRQ(TIM0_COMPB);
+const struct avr_mmcu_vcd_trace_t vcdTrace[] _MMCU_ = {
+	{ AVR_MCU_VCD_SYMBOL("PB1_HELD"), .mask = (1 << OUT_ENA), .what = (void *)&DDRB, },
+	{ AVR_MCU_VCD_SYMBOL("mStatus"), .what = (void *)&mStatus, },
+	{ AVR_MCU_VCD_SYMBOL("SE"), .mask = (1 << SE), .what = (void *)&MCUCR, },
+	{ AVR_MCU_VCD_SYMBOL("SM1"), .mask = (1 << SM1), .what = (void *)&MCUCR, },
+	{ AVR_MCU_VCD_SYMBOL("ADEN"), .mask = (1 << ADEN), .what = (void *)&ADCSRA, },
+	{ AVR_MCU_VCD_SYMBOL("TIM0_CS"), .mask = (1 << CS02) | (1 << CS01) | (1 << CS00), .what = (void *)&TCCR0B, },
+	{ AVR_MCU_VCD_SYMBOL("CLKPR"), .what = (void *)&CLKPR, },
+	{ AVR_MCU_VCD_SYMBOL("GPIOR0"), .what = (void *)&GPIOR0, },
+};
+#endif
+
+void stepGlow(void);
+void startSequence(const unsigned char *program);
+void stepSequence(void);
+void startAdc(void);
+void stopAdc(void);
+void stepSigmaDelta(void);
+void setBrightness(void);
+void pulseLeds(void);
+unsigned char readInputs(void);
 char getStatus(void);
 void setMode(void);
+unsigned char stateChecksum(void);
+void saveState(void);
+void restoreState(void);
+void setClock(unsigned char clkps);
+unsigned char checkBods(void);
+void enterSleep(void);
+#ifdef CHECK_INVARIANTS
+void checkInvariants(void);
+#endif
 void setup(void);
+void loop(void);
 
 //////////////////////////////////////////////////////////////////////////
 // @name:	WDT_vect
-// @func:	handles watchdog timer interrupt, to wake from sleep
+// @func:	handles watchdog timer interrupt, to wake from sleep.
+//			When an indicator program runs it also clocks the leds, so
+//			the status check runs on every ticksPerStatus-th call.
 //////////////////////////////////////////////////////////////////////////
 ISR(WDT_vect) {
 
-	sleep_disable();	
-	requestStatus = 1; /* Used to call getStatus() in main(). Prefered
-						  over calling getStatus() in interrupt to
-						  shorten interrupt handler length */
+	BENCH_ENTER(BENCH_WDT);
+	sleep_disable();
+	if ( seqProgram ) {
+		BENCH_ENTER(BENCH_SEQUENCE);
+		stepSequence();
+		BENCH_EXIT(BENCH_SEQUENCE);
+	}
+	if ( pulseMask )
+		requestPulse = 1;
+	if ( ++tickCount >= ticksPerStatus ) {
+		tickCount = 0;
+		requestStatus = 1; /* Used to call getStatus() in main(). Prefered
+							  over calling getStatus() in interrupt to
+							  shorten interrupt handler length */
+	}
+	BENCH_EXIT(BENCH_WDT);
 	
 }
 
@@ -72,6 +273,7 @@ ISR(WDT_vect) {
 //////////////////////////////////////////////////////////////////////////
 ISR(ADC_vect) {
 
+	BENCH_ENTER(BENCH_ADC);
 	adcVal = ADCL;
 	adcVal |= ADCH<<8; // get ADC values
 	if (numSamples < 10) {
@@ -83,9 +285,12 @@ ISR(ADC_vect) {
 		voltage = sumVolt / 10;
 		numSamples = 0;
 		sumVolt = 0;
-		MCUCR |= (1 << SM1); // power down - prepare for sleep
+		if ( !( TCCR0B & ( (1 << CS02) | (1 << CS01) | (1 << CS00) ) ) ) // no led pulse or glow running
+			MCUCR |= (1 << SM1); // power down - prepare for sleep
 		ADCSRA &= ~(1 << ADEN); // shut off ADC
+		PRR |= (1 << PRADC);	// and its clock
 	}
+	BENCH_EXIT(BENCH_ADC);
 	
 }
 
@@ -93,40 +298,268 @@ ISR(ADC_vect) {
 ///////////////////////////////////////////////////////////////////////////////////////
 //	@name:		Timer 0 Overflow Interrupt
 //	@call:		When Timer 0 overflows
-//	@note:		Used for 10-bit fast PWM output
+//	@note:		Software PWM for green, red is driven by OC0A
 ///////////////////////////////////////////////////////////////////////////////////////
 ISR(TIM0_OVF_vect) {
+	BENCH_ENTER(BENCH_TIM0_OVF);
 	sleep_disable();
-	// Red Off
-	PORTB |= (grn_glw << LED_GRN) | (red_glw << LED_RED);
+	// Green On
+	PORTB &= ~(grn_glw << LED_GRN);
+	BENCH_EXIT(BENCH_TIM0_OVF);
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////
 //	@name:		Timer 0 Compare A Interrupt
 //	@call:		When OCR1A is equal to compare value
-//	@note:		Used for 10-bit fast PWM output
+//	@note:		Software PWM for green, red is driven by OC0A
 ///////////////////////////////////////////////////////////////////////////////////////
 ISR(TIM0_COMPA_vect){
 	
+	BENCH_ENTER(BENCH_TIM0_COMPA);
 	sleep_disable();
-	countPWM++;
-	
-	if (countPWM >= PWM_RAMP_SPEED){	// PWM ramp speed
-		countPWM = 0;				// e.g. change duty cycle every 3rd overflow
-		indexPWM += indexDirPWM;	// adjust duty cycle
-		if (indexPWM >= PWM_MAX)		// if duty cycle = 100%,
-			indexDirPWM = -1;		// ramp down
-		else if (indexPWM <= PWM_MIN)		// else if duty cycle = 0%
-			indexDirPWM = 1;		// ramp up
-		OCR0A = indexPWM;
+	// Green Off
+	PORTB |= (grn_glw << LED_GRN);
+	BENCH_EXIT(BENCH_TIM0_COMPA);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////
+//	@name:		Timer 0 Compare B Interrupt
+//	@call:		When TCNT0 reaches OCR0B during an led pulse
+//	@note:		Ends the one-shot pulse started by pulseLeds
+///////////////////////////////////////////////////////////////////////////////////////
+ISR(TIM0_COMPB_vect){
+	
+	BENCH_ENTER(BENCH_TIM0_COMPB);
+	sleep_disable();
+	PORTB |= (1 << LED_GRN) | (1 << LED_RED);	// leds off
+	TCCR0B &= ~(1 << CS01) & ~(1 << CS00);	// Timer 0 Clock = 0
+	TIMSK &= ~(1 << OCIE0B);
+	PRR |= (1 << PRTIM0);	// and its clock
+	if ( !( ADCSRA & (1 << ADEN) ) ) // no adc cycles running
+		MCUCR |= (1 << SM1); // power down - prepare for sleep
+	BENCH_EXIT(BENCH_TIM0_COMPB);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	stepGlow
+// @func:	advances the breathing ramp one step per 16ms watchdog tick,
+//			so the PWM itself runs without any ramp interrupt
+//////////////////////////////////////////////////////////////////////////
+void stepGlow(void) {
+	
+	if (++phasePWM >= PWM_PHASES)	// next step of the breath
+		phasePWM = 0;
+	if (phasePWM < PWM_PHASES / 2)	// first half ramps up,
+		glowLevel = pgm_read_byte(&BREATH[phasePWM]);
+	else						// second half ramps down
+		glowLevel = pgm_read_byte(&BREATH[PWM_PHASES - 1 - phasePWM]);
+	OCR0A = glowLevel;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	stepSigmaDelta
+// @func:	first order sigma-delta, lights the sdMask leds for this
+//			tick when adding glowLevel carries out of the accumulator.
+//			Averages glowLevel/256 brightness with no PWM interrupts.
+//////////////////////////////////////////////////////////////////////////
+void stepSigmaDelta(void) {
+	
+	sdAcc += glowLevel;
+	if ( sdAcc < glowLevel )	// carry
+		PORTB &= ~sdMask;	// leds on
+	else
+		PORTB |= sdMask;	// leds off
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	startSequence
+// @func:	starts an indicator program and runs its first tick now
+// @parm:	program - PROGMEM opcodes, 0 stops the sequencer
+//////////////////////////////////////////////////////////////////////////
+void startSequence(const unsigned char *program) {
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {	// WDT_vect also steps the sequencer
+		seqProgram = program;
+		seqPc = 0;
+		seqWait = 0;
+		pulseMask = 0;
+		requestPulse = 0;	// drop a pulse the old program asked for
+		sdMask = 0;
+		if ( program )
+			stepSequence();
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	stepSequence
+// @func:	runs one watchdog tick of the indicator program. Opcodes
+//			execute until one holds or ramps, which ends the tick.
+//////////////////////////////////////////////////////////////////////////
+void stepSequence(void) {
+	
+	unsigned char op;
+	unsigned char arg;
+	unsigned char leds;
+	
+	if ( sdMask )
+		stepSigmaDelta();
+	
+	if ( seqWait ) {	// mid hold or ramp
+		seqWait--;
+		if ( seqRamp )
+			stepGlow();
+		return;
+	}
+	
+	while (1) {
+		op = pgm_read_byte(&seqProgram[seqPc++]);
+		arg = op & SEQ_ARG;
 		
-		PORTB &= ~(grn_glw << LED_GRN) & ~(red_glw << LED_RED);
+		switch ( op & SEQ_OP ) {
+			
+			case SEQ_SET(0) :
+				leds = ( (arg & SEQ_RED) ? (1 << LED_RED) : 0 )
+					| ( (arg & SEQ_GRN) ? (1 << LED_GRN) : 0 );
+				PORTB |= (1 << LED_GRN) | (1 << LED_RED);	// leds off
+				if ( ledPulse )
+					pulseMask = leds;	// dimmed, lit by pulseLeds
+				else {
+					pulseMask = 0;
+					PORTB &= ~leds;
+				}
+				grn_glw = ( arg & SEQ_GRN_PWM ) ? 1 : 0;
+				sdMask = ( (arg & SEQ_RED_SD) ? (1 << LED_RED) : 0 )
+					| ( (arg & SEQ_GRN_SD) ? (1 << LED_GRN) : 0 );
+				break;
+			
+			case SEQ_LOOP(0) :
+				seqPc = arg ? seqPc - 1 - arg : 0;
+				break;
+			
+			default :	// SEQ_HOLD, SEQ_RAMP
+				seqRamp = op & SEQ_RAMP(0);
+				if ( seqRamp )
+					stepGlow();
+				if ( arg )
+					seqWait = arg - 1;	// this tick counts as the first
+				else
+					seqPc--;			// forever, repeat this opcode
+				return;
+		}
+	}
+}
 
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	setBrightness
+// @func:	below BATTERY_GOOD, shortens the on-pulse of sequenced leds
+//			in step with voltage, down to 0.8ms per 16ms tick. The
+//			longest dimmed pulse stays below PULSE_SOLID, 4.1ms under
+//			solid leds or 2.4ms under the 3ms PULSED_SOLID flash.
+//////////////////////////////////////////////////////////////////////////
+void setBrightness(void) {
+	
+	if ( passVoltage >= BATTERY_GOOD || mStatus <= 3 || mStatus >= 8 )
+		ledPulse = PULSE_SOLID;	// good battery or USB
+	else if ( passVoltage <= BATTERY_CRITICAL )
+		ledPulse = PULSE_MIN;
+	else
+		ledPulse = PULSE_MIN + ( (passVoltage - BATTERY_CRITICAL) >> PULSE_SHIFT );
+	
+	// brightened to solid mid program, the last pulse ended before this
+	// wake, so light the dimmed leds now rather than arm OCR0B = 0
+	if ( !ledPulse && pulseMask ) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {	// WDT_vect reads pulseMask
+			PORTB &= ~pulseMask;	// leds on
+			pulseMask = 0;
+			requestPulse = 0;
+		}
 	}
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+// @name:	pulseLeds
+// @func:	lights the dimmed leds and starts Timer 0 as a one-shot,
+//			so the cpu idles until TIM0_COMPB_vect turns them off
+//////////////////////////////////////////////////////////////////////////
+void pulseLeds(void) {
+	
+	PRR &= ~(1 << PRTIM0);	// Timer 0 on
+	PORTB &= ~pulseMask;	// leds on
+	TCCR0A &= ~(1 << WGM01) & ~(1 << WGM00);	// normal mode, Fast PWM buffers OCR0B
+	TCNT0 = 0;
+	OCR0B = ledPulse;
+	TIFR = (1 << OCF0B);	// clear a stale match
+	TIMSK |= (1 << OCIE0B);
+	MCUCR &= ~(1 << SM1);	// idle, Timer 0 needs the i/o clock
+	TCCR0B |= (1 << CS01);	// Timer 0 Clock = 125kHz/8, 64us counts
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	startAdc
+// @func:	powers the ADC up just in time and starts a sample burst,
+//			ADC_vect powers it down again when the burst is done
+//////////////////////////////////////////////////////////////////////////
+void startAdc(void) {
+	
+	setClock(CLOCK_SLOW);	// ADC prescaler is set for the slow clock
+	PRR &= ~(1 << PRADC);	// ADC clock on
+	MCUCR &= ~(1 << SM1);  // go to idle mode
+	ADCSRA |= (1 << ADEN) | (1 << ADSC); // start adc cycles
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	stopAdc
+// @func:	disables the ADC, then stops its clock, and drops any
+//			samples of a burst it cut short
+//////////////////////////////////////////////////////////////////////////
+void stopAdc(void) {
+	
+	ADCSRA &= ~(1 << ADEN); // shut off ADC
+	PRR |= (1 << PRADC);	// ADC must be off before its clock
+	numSamples = 0;			// drop a burst cut short,
+	sumVolt = 0;			// the next one starts clean
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	readInputs
+// @func:	reads PINB three times, 20us apart at CLOCK_FAST (160us at
+//			CLOCK_SLOW), and keeps the 2 of 3 majority of each bit, so
+//			a glitch shorter than the spacing cannot flip an input.
+//			Longer glitches are left to the MODE_STABLE_WAKES filter.
+//			The CHR_STA pull-up and input buffer are on only for the
+//			reads, see the pin policy.
+// @rtrn:	voted PINB value
+//////////////////////////////////////////////////////////////////////////
+unsigned char readInputs(void) {
+	
+	unsigned char a, b, c;
+	
+	DIDR0 &= ~(1 << ADC3D);		// CHR_STA input buffer on
+	PORTB |= (1 << CHR_STA);	// and its pull-up
+	_delay_us(5);				// open drain pin charges through it
+	a = PINB;
+	_delay_us(20);
+	b = PINB;
+	_delay_us(20);
+	c = PINB;
+	PORTB &= ~(1 << CHR_STA);
+	DIDR0 |= (1 << ADC3D);
+	
+	return (a & b) | (a & c) | (b & c);
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 // @name:	findMode
 // @func:	determine status of switch, USB, and Li-Ion IC
@@ -134,17 +567,35 @@ ISR(TIM0_COMPA_vect){
 //////////////////////////////////////////////////////////////////////////
 char getStatus(void) {
 	
-	if ( mStatus == 7 ) {
-		DDRB &= ~(1 << OUT_ENA); // disable 3.3V
-		_delay_us(5);	// wait for pin to settle before reading
+	unsigned char pins = readInputs();
+	
+	if ( DDRB & (1 << OUT_ENA) ) { // 3.3V held off by mode 7 cutoff
+		
+		// only USB or the switch can end cutoff, so probe the switch
+		// less often the longer it stays on
+		if ( --probeCount && !( pins & (1 << USB_STA) ) )
+			return 7;
+		
+		DDRB &= ~(1 << OUT_ENA); // release pin to read switch
+		
+		// useful work while the pin settles at CLOCK_FAST, replaces
+		// _delay_us(5), then one read so 3.3V is up for about 20us
+		probeCount = 1; // probe again next wake unless still in cutoff
+		PRR &= ~(1 << PRADC);	// ADC clock on, for startAdc below
+		pins = ( pins & ~(1 << OUT_ENA) ) | ( PINB & (1 << OUT_ENA) );
+		if ( ( pins & ( (1 << OUT_ENA) | (1 << USB_STA) ) ) == (1 << OUT_ENA)
+			&& passVoltage <= BATTERY_CRITICAL )
+			DDRB |= (1 << OUT_ENA); // still cutoff, hold 3.3V off again
+		
+		startAdc(); // drops to CLOCK_SLOW, idle while it samples
 	}
 	
-	if ( !( PINB & (1 << OUT_ENA) ) ) {
-		if ( !( PINB & (1 << USB_STA) ) ) {
+	if ( !( pins & (1 << OUT_ENA) ) ) {
+		if ( !( pins & (1 << USB_STA) ) ) {
 			/*	Mode 1 */
 			return 1; 
 		}
-		else if ( !( PINB & (1 << CHR_STA) ) ) {
+		else if ( !( pins & (1 << CHR_STA) ) ) {
 			/*	Mode 2 */
 			return 2; 
 		}
@@ -154,52 +605,44 @@ char getStatus(void) {
 		} 
 	}
 	else {
-		if ( !( PINB & (1 << USB_STA) ) ) {
-			if ( voltage > BATTERY_GOOD ) {
+		if ( !( pins & (1 << USB_STA) ) ) {
+			if ( passVoltage > BATTERY_GOOD ) {
 				/*	Mode 4 */
 				if ( watchdogCount % START_ADC_1S_WATCHDOG == 0 ) {
 					watchdogCount = 0;
-					MCUCR &= ~(1 << SM1);  // go to idle mode
-					ADCSRA |= (1 << ADEN) | (1 << ADSC); // start adc cycles
+					startAdc(); // power up adc, idle while it samples
 				}
 				watchdogCount++;
 				return 4; 
 			}
-			else if ( voltage > BATTERY_LOW )	{
+			else if ( passVoltage > BATTERY_LOW )	{
 				/*	Mode 5 */
-				PORTB ^= (1 << LED_RED); // battery low warning light
 				watchdogCount++;
 				if ( watchdogCount % START_ADC_1S_WATCHDOG == 0 ) {
 					watchdogCount = 0;
-					MCUCR &= ~(1 << SM1);  // go to idle mode
-					ADCSRA |= (1 << ADEN) | (1 << ADSC); // start adc cycles
+					startAdc(); // power up adc, idle while it samples
 				}
 				return 5; 
 			}
-			else if ( voltage > BATTERY_CRITICAL ) {
+			else if ( passVoltage > BATTERY_CRITICAL ) {
 				/*	Mode 6 */
-				PORTB ^= (1 << LED_RED); // battery critical warning light
 				watchdogCount++;
-				if ( watchdogCount % START_ADC_0_5S_WATCHDOG == 0 ) {
+				if ( watchdogCount % START_ADC_1S_WATCHDOG == 0 ) {
 					watchdogCount = 0;
-					MCUCR &= ~(1 << SM1);  // go to idle mode
-					ADCSRA |= (1 << ADEN) | (1 << ADSC); // start adc cycles
+					startAdc(); // power up adc, idle while it samples
 				}
 				return 6; 
 			}
 			else {
 				/*	Mode 7 */
-				watchdogCount++;
-				if ( watchdogCount % START_ADC_1S_WATCHDOG == 0 ) {
-					watchdogCount = 0;
-					MCUCR &= ~(1 << SM1);  // go to idle mode (wake up, bitch!)
-					ADCSRA |= (1 << ADEN) | (1 << ADSC); // start adc cycles
-				}
+				if ( probeInterval < PROBE_BACKOFF_MAX )
+					probeInterval <<= 1; // back off, voltage is sampled per probe
+				probeCount = probeInterval;
 				DDRB |= (1 << OUT_ENA); // re-enable 3.3V
 				return 7; 
 			}
 		}
-		else if ( !( PINB & (1 << CHR_STA) ) ) {
+		else if ( !( pins & (1 << CHR_STA) ) ) {
 			/*	Mode 8 */
 			return 8; 
 		}
@@ -217,6 +660,30 @@ char getStatus(void) {
 // @func:	controls green led, red led, and 3.3V based on mode
 //////////////////////////////////////////////////////////////////////////
 void setMode(void) {
+	
+	unsigned char leds;
+#ifdef MODE_TRACE
+	TraceEntry *entry = traceNext;
+	
+	entry->tick = traceTick;
+	entry->mode = mStatus;
+	entry->adc = adcVal;	// low byte, unique from 2200mV to 4400mV
+	if ( ++entry == &modeTrace[MODE_TRACE_LEN] )
+		entry = modeTrace;
+	traceNext = entry;
+#endif
+	
+	// Red follows PORTB unless a mode hands it to the OC0A PWM output
+	TCCR0A &= ~(1 << COM0A1) & ~(1 << COM0A0);
+	TIMSK &= ~(1 << OCIE0B);	// cancel a running led pulse
+	TCCR0B &= ~(1 << CS01) & ~(1 << CS00);	// Timer 0 Clock = 0
+	PRR |= (1 << PRTIM0);	// Timer 0 off unless a mode needs it
+	sleepBods = 0;		// BOD on in sleep,
+	idleClock = CLOCK_SLOW;	// slow clock between passes,
+	grn_glw = 0;		// no green PWM,
+	startSequence(0);	// no indicator program,
+	ticksPerStatus = 1;	// status on every watchdog call
+	
 	switch(mStatus) {
 		
 		
@@ -231,11 +698,12 @@ void setMode(void) {
 			
 			// Power
 			MCUCR |= (1 << SM1); // power down
+			sleepBods = 1; // BOD off in power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR |= (1 << WDP2) | (1 << WDP1); // 1 second watchdog
 			WDTCR &= ~(1 << WDP0);
-			ADCSRA &= ~(1 << ADEN); // shut off ADC
+			stopAdc(); // shut off ADC
 			break;
 			
 			
@@ -244,21 +712,22 @@ void setMode(void) {
 		case 2 :
 		
 			// I/O
-			red_glw = 1;
-			grn_glw = 0;
-			// @TODO glow red
 			DDRB |= (1 << LED_RED);		// enable red
 			DDRB &= ~(1 << LED_GRN) & ~(1 << OUT_ENA);	// disable green, 3.3V
 			PORTB &= ~(1 << LED_GRN);	// green off, red off
 			PORTB |= (1 << LED_RED);	// red off
+			PRR &= ~(1 << PRTIM0);	// Timer 0 on
+			TCCR0A |= (1 << WGM01) | (1 << WGM00);	// Fast PWM, pulses leave normal mode
+			TCCR0A |= (1 << COM0A1) | (1 << COM0A0); // glowing red, OC0A low until OCR0A
 			
 			// Power
 			MCUCR &= ~(1 << SM1);	// idle
-			TIMSK |= (1 << OCIE0A) | (1 << TOIE0);	// Enable Timer 0 Interrupts
-			TCCR0B |= (1 << CS01);	// Clock = prescaler/256
-			WDTCR |= (1 << WDP1);	// 1 second watchdog
-			WDTCR &= ~(1 << WDP0);
-			ADCSRA &= ~(1 << ADEN); // shut off ADC
+			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // OC0A needs no Timer 0 Interrupts
+			TCCR0B |= (1 << CS00);	// Clock = 125kHz, 488Hz PWM, OC0A needs no ISR to run fast
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1) & ~(1 << WDP0); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			stopAdc(); // shut off ADC
+			startSequence(SEQ_GLOW); // glowing red
 			break;
 			
 			
@@ -273,11 +742,17 @@ void setMode(void) {
 			
 			// Power
 			MCUCR |= (1 << SM1); // power down
+			sleepBods = 1; // BOD off in power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR |= (1 << WDP2) | (1 << WDP1); // 1 second watchdog
 			WDTCR &= ~(1 << WDP0);
-			ADCSRA &= ~(1 << ADEN); // shut off ADC
+#ifdef PULSED_SOLID
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			startSequence(SEQ_SOLID_RED); // pulsed red
+#endif
+			stopAdc(); // shut off ADC
 			break;
 		
 		
@@ -291,48 +766,56 @@ void setMode(void) {
 			PORTB &= ~(1 << LED_GRN) & ~(1 << LED_RED); // green on, red off
 			
 			// Power
-			MCUCR |= (1 << SM1); // power down
+			if ( !( ADCSRA & (1 << ADEN) ) ) // else ADC_vect selects it after the burst
+				MCUCR |= (1 << SM1); // power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR |= (1 << WDP2) | (1 << WDP1); // 1 second watchdog
 			WDTCR &= ~(1 << WDP0);
+#ifdef PULSED_SOLID
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			startSequence(SEQ_SOLID_GRN); // pulsed green
+#endif
 			break;
 			
 		/*	On, no USB, 3.4V < V < 3.5V
-			deep sleep, green on, red 1s blink, voltage check */
+			deep sleep, green on, red 1s flash, voltage check */
 		case 5 :
 		
 			// I/O
 			DDRB |= (1 << LED_GRN) | (1 << LED_RED); // enable green, red
 			DDRB &= ~(1 << OUT_ENA); // disable 3.3V
 			PORTB &= ~(1 << LED_GRN) & ~(1 << LED_RED); // green on, red on
-			// @TODO red slow blinking
 			
 			// Power
-			MCUCR |= (1 << SM1); // power down
+			if ( !( ADCSRA & (1 << ADEN) ) ) // else ADC_vect selects it after the burst
+				MCUCR |= (1 << SM1); // power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
-			WDTCR &= ~(1 << WDP0);
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1) & ~(1 << WDP0); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			startSequence(SEQ_LOW); // battery low warning light
 			break;
 			
 			
 		/*	On, no USB, 3.3V < V < 3.4V
-			deep sleep, green on, red 1/2s blink, voltage check */
+			deep sleep, green on, red 1/2s flash, voltage check */
 		case 6 :
 			
 			// I/O
 			DDRB |= (1 << LED_GRN) | (1 << LED_RED); // enable green, red
 			DDRB &= ~(1 << OUT_ENA); // disable 3.3V
 			PORTB &= ~(1 << LED_GRN) & ~(1 << LED_RED); // green on, red on
-			// @TODO red fast blinking
 			
 			// Power
-			MCUCR |= (1 << SM1); // power down
+			if ( !( ADCSRA & (1 << ADEN) ) ) // else ADC_vect selects it after the burst
+				MCUCR |= (1 << SM1); // power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP0); // 1/2 second watchdog
-			WDTCR &= ~(1 << WDP1);
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1) & ~(1 << WDP0); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			startSequence(SEQ_CRITICAL); // battery critical warning light
 			break;
 			
 			
@@ -343,13 +826,17 @@ void setMode(void) {
 			// I/O
 			DDRB &= ~(1 << LED_GRN) & ~(1 << LED_RED);  // disable green, red led
 			DDRB |= (1 << OUT_ENA); // enable 3.3V
+			probeInterval = 1; // restart switch probe back-off
+			probeCount = 1;
 			PORTB &= ~(1 << LED_GRN) & ~(1 << LED_RED); // green off, red off
 			
 			// Power
-			MCUCR |= (1 << SM1); // power down
+			if ( !( ADCSRA & (1 << ADEN) ) ) // else ADC_vect selects it after the burst
+				MCUCR |= (1 << SM1); // power down
+			sleepBods = 1; // BOD off in power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR |= (1 << WDP2) | (1 << WDP1); // 1 second watchdog
 			WDTCR &= ~(1 << WDP0);
 			break;
 			
@@ -359,19 +846,31 @@ void setMode(void) {
 		case 8 :
 		
 			// I/O
-			red_glw = 0; // red off
-			grn_glw = 1; // glowing green
 			DDRB |= (1 << LED_GRN);	// enable green
 			DDRB &= ~(1 << LED_RED) & ~(1 << OUT_ENA); // disable red, 3.3V
 			PORTB &= ~(1 << LED_GRN) & ~(1 << LED_RED); // green on, red off
 
 			// Power
+#ifdef SIGMA_DELTA_GLOW
+			MCUCR |= (1 << SM1); // power down
+			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+#else
 			MCUCR &= ~(1 << SM1); // idle
+			PRR &= ~(1 << PRTIM0);	// Timer 0 on
+			TCCR0A |= (1 << WGM01) | (1 << WGM00);	// Fast PWM, pulses leave normal mode
 			TIMSK |= (1 << OCIE0A) | (1 << TOIE0);	// Enable Timer 0 Interrupts
-			TCCR0B	|=	(1 << CS01);	// Timer 0 Clock = prescaler/256
-			WDTCR |= (1 << WDP1); // 1 second watchdog
-			WDTCR &= ~(1 << WDP0);
-			ADCSRA &= ~(1 << ADEN); // shut off ADC
+			TCCR0B	|=	(1 << CS01);	// Timer 0 Clock = 1MHz/8, 488Hz PWM
+			idleClock = CLOCK_FAST;	// at 125kHz the two ISRs took ~10% of each PWM period
+#endif
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1) & ~(1 << WDP0); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			stopAdc(); // shut off ADC
+#ifdef SIGMA_DELTA_GLOW
+			startSequence(SEQ_GLOW_GRN_SD); // dithered green glow
+#else
+			startSequence(SEQ_GLOW_GRN); // glowing green
+#endif
 			break;
 			
 			
@@ -386,15 +885,168 @@ void setMode(void) {
 
 			// Power
 			MCUCR |= (1 << SM1); // power down
+			sleepBods = 1; // BOD off in power down
 			TIMSK &= ~(1 << OCIE0A) & ~(1 << TOIE0); // Disable Timer 0 Interrupts
-			TCCR0B &= ~(1 << CS01); // Timer 0 Clock = 0
-			WDTCR |= (1 << WDP1); // 1 second watchdog
+			TCCR0B &= ~(1 << CS01) & ~(1 << CS00); // Timer 0 Clock = 0
+			WDTCR |= (1 << WDP2) | (1 << WDP1); // 1 second watchdog
 			WDTCR &= ~(1 << WDP0);
-			ADCSRA &= ~(1 << ADEN); // shut off ADC
+#ifdef PULSED_SOLID
+			WDTCR &= ~(1 << WDP2) & ~(1 << WDP1); // 16ms watchdog
+			ticksPerStatus = TICKS_16MS_1S;	// status once a second
+			startSequence(SEQ_SOLID_GRN); // pulsed green
+#endif
+			stopAdc(); // shut off ADC
 			break;
 			
 	}
 	
+	// Pin policy, leds a mode disabled are driven off rather than floated
+	leds = ~DDRB & ( (1 << LED_GRN) | (1 << LED_RED) );
+	PORTB |= leds;	// high first, so the pin never drives an led on
+	DDRB |= leds;
+	
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	stateChecksum
+// @func:	checksum over saved state, seeded so cleared RAM is invalid
+// @rtrn:	checksum byte
+//////////////////////////////////////////////////////////////////////////
+unsigned char stateChecksum(void) {
+	
+	unsigned char *p = (unsigned char *)&saved;
+	unsigned char sum = 0xA5;
+	unsigned char i;
+	
+	for ( i = 0; i < offsetof(SavedState, check); i++ ) // not sizeof, padding may follow check
+		sum = (sum << 1 | sum >> 7) ^ p[i]; // rotate, so byte order counts
+	return sum;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	saveState
+// @func:	copies mode, voltage and scheduler state to .noinit RAM
+//////////////////////////////////////////////////////////////////////////
+void saveState(void) {
+	
+	saved.mode = mStatus;
+	saved.voltage = passVoltage;
+	saved.watchdogCount = watchdogCount;
+	saved.probeInterval = probeInterval;
+	saved.check = stateChecksum();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	restoreState
+// @func:	after a watchdog, brown-out or external reset, resumes the
+//			saved mode so a reset near cutoff cannot briefly re-enable
+//			the output. Power-on or a bad checksum keeps the defaults.
+//////////////////////////////////////////////////////////////////////////
+void restoreState(void) {
+	
+	unsigned char resetFlags = MCUSR;
+	
+	MCUSR = 0;
+	if ( ( resetFlags & (1 << PORF) ) || saved.check != stateChecksum() )
+		return;
+	if ( saved.mode < 1 || saved.mode > 9 )
+		return;
+	
+	voltage = saved.voltage;
+	passVoltage = voltage;
+	mStatus = saved.mode;
+	cStatus = saved.mode;
+	setMode(); // re-apply pins now, mode 7 drives OUT_ENA low at once
+	pStatus = mStatus;
+	
+	watchdogCount = saved.watchdogCount;
+	probeInterval = saved.probeInterval;
+	probeCount = probeInterval;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	setClock
+// @func:	changes the system clock prescaler with the timed CLKPR
+//			sequence. The ADC prescaler and pulse timing are set for
+//			CLOCK_SLOW, so only raise the clock while neither is running.
+//			Mode 8 sets Timer 0 for CLOCK_FAST and stays there.
+// @parm:	clkps - CLOCK_FAST or CLOCK_SLOW
+//////////////////////////////////////////////////////////////////////////
+void setClock(unsigned char clkps) {
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		CLKPR = (1 << CLKPCE);
+		CLKPR = clkps;	// within 4 cycles of CLKPCE
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	checkBods
+// @func:	runs the timed BODS sequence once. Only revisions with BOD
+//			sleep disable hold BODS set for the three cycles after it,
+//			older silicon reads it back as 0. Call with interrupts off.
+// @rtrn:	1 if BODS is supported
+//////////////////////////////////////////////////////////////////////////
+unsigned char checkBods(void) {
+	
+	unsigned char mcucr;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {	// an ISR would break the timing
+		mcucr = hal_bods_probe();
+	}
+	return ( mcucr & (1 << BODS) ) ? 1 : 0;
+}
+
+
+#ifdef CHECK_INVARIANTS
+//////////////////////////////////////////////////////////////////////////
+// @name:	checkInvariants
+// @func:	checks the power and output rules that must hold whenever
+//			the chip goes back to sleep, ids are listed in hal.h
+//////////////////////////////////////////////////////////////////////////
+void checkInvariants(void) {
+	
+	// from the inputs alone, not the mode: switch on, no USB and a
+	// critical cell at the last status pass must hold 3.3V off
+	if ( ( checkPins & ( (1 << OUT_ENA) | (1 << USB_STA) ) ) == (1 << OUT_ENA)
+		&& passVoltage <= BATTERY_CRITICAL )
+		HAL_CHECK(INV_CUTOFF_HELD, DDRB & (1 << OUT_ENA));
+	HAL_CHECK(INV_OUT_ENA_LOW, !( DDRB & PORTB & (1 << OUT_ENA) ));
+	if ( MCUCR & (1 << SM1) ) {
+		HAL_CHECK(INV_ADC_PD, !( ADCSRA & (1 << ADEN) ));
+		HAL_CHECK(INV_TIM0_PD, !( TIMSK & ( (1 << OCIE0A) | (1 << OCIE0B) | (1 << TOIE0) ) ));
+	}
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	enterSleep
+// @func:	sleeps in the mode selected by MCUCR. In power down for the
+//			modes that allow it, also turns the brown-out detector off
+//			for the duration of the sleep. Returns at once if an ISR
+//			has raised a request since loop() checked.
+//////////////////////////////////////////////////////////////////////////
+void enterSleep(void) {
+	
+	cli();	// a request raised after loop() looked would wait a whole tick
+	if ( requestStatus || requestPulse ) {
+		sei();
+		return;
+	}
+	sleep_enable();
+	if ( bodsSupported && sleepBods && ( MCUCR & (1 << SM1) ) )
+		hal_sleep_bods();	// BODS write, sei and sleep in one asm block
+	else {
+		sei();			// sei holds off interrupts one more
+		sleep_cpu();	// instruction, so the request check holds
+	}
+	sleep_disable();
 }
 
 
@@ -404,51 +1056,131 @@ void setMode(void) {
 //////////////////////////////////////////////////////////////////////////
 void setup (void) {
 	
-	// Configure Timer 0
-	TCCR0A	|=	(1 << WGM01) | (1 << WGM00);	// Fast PWM, no OC0A connection
+	// Configure clock
+	setClock(CLOCK_SLOW);
+	
+	// Configure Timer 0, Fast PWM is set by the modes that glow
 	OCR0A	=	0x00;							// Initial duty cycle
 	
 	// Configure ADC
 	ADMUX |= (1 << MUX3) | (1 << MUX2); // 1.1V, Vbg as input voltage and Vcc as reference
-	ADCSRA |= (1 << ADPS2) | (1 << ADPS1); // Prescale 8MHz by 64 = 125kHz
+	ADCSRA |= (1 << ADPS0); // Prescale CLOCK_SLOW by 2 = 62.5kHz, adc only runs slow
 	ADCSRA |= (1 << ADIE);  // enable ADC interrupts
 		
-	// Configure sleep mode
+	// Configure power reduction
 	PRR |= (1 << PRTIM1) | (1 << PRUSI); // turn off timer 1, USI
+	PRR |= (1 << PRTIM0) | (1 << PRADC); // timer 0, ADC until a mode needs them
+	ACSR |= (1 << ACD);	// turn off analog comparator
+	DIDR0 |= (1 << ADC0D) | (1 << ADC1D) | (1 << AIN0D); // PB5, PB2, PB0 are never read
+	DIDR0 |= (1 << ADC3D);	// PB3 only while readInputs samples it
+	
+	// Configure sleep mode
 	MCUCR |= (1 << SM1); // power down mode
+	bodsSupported = checkBods();
 	
 	// Configure Watchdog Timer 
 	WDTCR |= (1 << WDIE) | (1 << WDP2) | (0 << WDP1); // 1 second watchdog
+	
+#ifdef MODE_TRACE
+	// Trace survives warm resets, power-on leaves it random
+	if ( MCUSR & (1 << PORF) || traceNext < modeTrace
+		|| traceNext >= &modeTrace[MODE_TRACE_LEN] ) {
+		for ( traceNext = modeTrace; traceNext < &modeTrace[MODE_TRACE_LEN]; traceNext++ )
+			traceNext->mode = 0;
+		traceNext = modeTrace;
+	}
+	traceNext->tick = 0;	// reset marker
+	traceNext->mode = 0;
+	traceNext->adc = 0;
+	if ( ++traceNext == &modeTrace[MODE_TRACE_LEN] )
+		traceNext = modeTrace;
+#endif
+	
+	// Resume mode after a warm reset
+	restoreState();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	loop
+// @func:	one pass of the main loop, from wake-up back to sleep
+//////////////////////////////////////////////////////////////////////////
+void loop(void) {
+	
+	unsigned char sStatus;	// status sampled this wake
+	
+	// runs only from watchdog interrupts
+	if ( requestStatus == 1) {
+		
+		// compute fast, unless the ADC or Timer 0 is clocked
+		if ( !( ADCSRA & (1 << ADEN) )
+			&& !( TCCR0B & ( (1 << CS02) | (1 << CS01) | (1 << CS00) ) ) )
+			setClock(CLOCK_FAST);
+		
+#ifdef MODE_TRACE
+		traceTick++;
+#endif
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {	// ADC_vect writes it a byte at a time
+			passVoltage = voltage;
+		}
+		BENCH_ENTER(BENCH_STATUS);
+		sStatus = getStatus();
+		BENCH_EXIT(BENCH_STATUS);
+#ifdef CHECK_INVARIANTS
+		checkPins = PINB;	// the chip reads a held OUT_ENA as off
+#endif
+		
+		if ( sStatus != cStatus ) {	// new candidate, restart count
+			cStatus = sStatus;
+			stableCount = 0;
+		}
+		if ( stableCount < MODE_STABLE_WAKES )
+			stableCount++;
+		
+		// commit only a mode seen on consecutive wakes, except at boot
+		if ( stableCount >= MODE_STABLE_WAKES || pStatus == 0 )
+			mStatus = cStatus;
+
+		setBrightness(); // before setMode, so new programs start dimmed
+		if ( mStatus != pStatus ) {
+			BENCH_ENTER(BENCH_SETMODE);
+			setMode();
+			BENCH_EXIT(BENCH_SETMODE);
+		}
+		pStatus = mStatus;
+		requestStatus = 0;
+		saveState();
+		setClock( ( ADCSRA & (1 << ADEN) ) ? CLOCK_SLOW : idleClock );	// ADC runs slow
+		
+	}
+	
+	// dimmed leds, once per watchdog tick
+	if ( requestPulse == 1 ) {
+		pulseLeds();
+		requestPulse = 0;
+	}
+
+#ifdef CHECK_INVARIANTS
+	checkInvariants();
+#endif
+	enterSleep();
+	//_delay_ms(10);
+	
 }
 
 
+#ifndef HOST_BUILD // host drivers call setup() and loop() themselves
 int main(void){
 	
 	setup();
 	
 	sei();
 	
-	// disable ADC
-	// disable analog comparator
-	// make outputs inputs
-	
 	while(1){
 		
-		// runs only from watchdog interrupts
-		if ( requestStatus == 1) {
-			
-			mStatus = getStatus();
-
-			if ( mStatus != pStatus )
-				setMode();
-			pStatus = mStatus;
-			requestStatus = 0;
-			
-		}
-	
-		sleep_mode();
-		//_delay_ms(10);
+		loop();
 		
 	}
 	
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	bench.c
+// @func:	simavr benchmark of main.c. Holds each of the nine modes
+//			with the inputs in host/stimuli.h, from power-on each time,
+//			and reports the awake time per second of each mode and the
+//			cycles of every BENCH section over all of them.
+//			usage: bench [elf] [seconds per mode]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+#include "stimuli.h"
+
+
+int main(int argc, char **argv) {
+
+	const char *elf = argc > 1 ? argv[1] : "main.elf";
+	double seconds = argc > 2 ? atof(argv[2]) : 10.0;
+	SimSection total[SIM_SECTIONS] = { { 0 } };
+	SimWake w;
+	double us, awakeUs;
+	unsigned long wakes, cycles;
+	unsigned char mode, id;
+	SimSection *s, *t;
+
+	printf("mode                  wakes/s  awake ms/s  cycles/wake\n");
+	for ( mode = 1; mode <= 9; mode++ ) {
+		if ( simOpen(elf) || simSettle(mode) ) {
+			printf("%u %-18s did not settle\n", mode, MODE_STIMULI[mode].name);
+			return 1;
+		}
+		simClearSections();
+		us = awakeUs = 0;
+		wakes = cycles = 0;
+		while ( us < seconds * 1e6 ) {
+			if ( simWake(&w) ) {
+				printf("%u %-18s core stopped\n", mode, MODE_STIMULI[mode].name);
+				return 1;
+			}
+			us += w.us;
+			awakeUs += w.runFastUs + w.runSlowUs;
+			cycles += w.cycles;
+			wakes++;
+		}
+		printf("%u %-18s %8.1f  %10.3f  %11.0f\n", mode, MODE_STIMULI[mode].name,
+			wakes / ( us / 1e6 ), awakeUs / ( us / 1e6 ) / 1e3, (double)cycles / wakes);
+
+		for ( id = 1; id < SIM_SECTIONS; id++ ) {
+			s = &simSections[id];
+			t = &total[id];
+			if ( s->count == 0 )
+				continue;
+			if ( t->count == 0 || s->min < t->min )
+				t->min = s->min;
+			if ( s->max > t->max )
+				t->max = s->max;
+			t->sum += s->sum;
+			t->count += s->count;
+		}
+		simClose();
+	}
+
+	printf("\nsection              count     min     avg     max  cycles\n");
+	for ( id = 1; id < SIM_SECTIONS; id++ ) {
+		t = &total[id];
+		if ( !simSectionName(id) )
+			continue;
+		if ( t->count == 0 ) {
+			printf("%-18s %7u       -       -       -\n", simSectionName(id), 0);
+			continue;
+		}
+		printf("%-18s %7lu %7lu %7.1f %7lu\n", simSectionName(id), t->count,
+			t->min, (double)t->sum / t->count, t->max);
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	energy.c
+// @func:	average supply current per mode, from the time simavr spends
+//			in each core state and clock and the datasheet figures in
+//			host/power_model.h. Several elfs print side by side, so a
+//			build option or a change can be compared mode by mode.
+//			usage: energy elf [elf...]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+#include "stimuli.h"
+#include "power_model.h"
+
+#define ELFS_MAX	4
+
+const double SECONDS = 20.0;	// held per mode, after it settles
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	holdMode
+// @func:	settles a mode from power-on, then averages chip and led
+//			current over SECONDS
+// @rtrn:	0, or -1 if the mode did not settle or the core stopped
+//////////////////////////////////////////////////////////////////////////
+int holdMode(const char *elf, unsigned char mode, double *chipUa, double *ledUa) {
+
+	SimWake w;
+	double us = 0, chip = 0, led = 0;
+
+	if ( simOpen(elf) || simSettle(mode) )
+		return -1;
+	while ( us < SECONDS * 1e6 ) {
+		if ( simWake(&w) )
+			return -1;
+		chip += w.runFastUs * UA_ACTIVE_1MHZ + w.runSlowUs * UA_ACTIVE_125K
+			+ w.idleFastUs * UA_IDLE_1MHZ + w.idleSlowUs * UA_IDLE_125K
+			+ w.adcUs * UA_ADC + w.downUs * UA_POWER_DOWN
+			+ ( w.us - w.downBodsUs ) * UA_BOD;
+		led += w.ledUs * UA_LED;
+		us += w.us;
+	}
+	simClose();
+	*chipUa = chip / us;
+	*ledUa = led / us;
+	return 0;
+}
+
+
+int main(int argc, char **argv) {
+
+	double chip[ELFS_MAX], led[ELFS_MAX], total[ELFS_MAX] = { 0 };
+	int elfs = argc - 1 < ELFS_MAX ? argc - 1 : ELFS_MAX;
+	unsigned char mode;
+	int i;
+
+	if ( elfs < 1 ) {
+		fprintf(stderr, "usage: energy elf [elf...]\n");
+		return 2;
+	}
+	printf("%-20s", "mode");
+	for ( i = 0; i < elfs; i++ )
+		printf("  %21.21s", argv[i + 1]);
+	printf("\n%-20s", "");
+	for ( i = 0; i < elfs; i++ )
+		printf("  %10s %10s", "chip uA", "led uA");
+	printf("\n");
+
+	for ( mode = 1; mode <= 9; mode++ ) {
+		printf("%u %-18s", mode, MODE_STIMULI[mode].name);
+		for ( i = 0; i < elfs; i++ ) {
+			if ( holdMode(argv[i + 1], mode, &chip[i], &led[i]) ) {
+				printf("  %21s\n", "did not settle");
+				return 1;
+			}
+			printf("  %10.1f %10.0f", chip[i], led[i]);
+			total[i] += chip[i] + led[i];
+		}
+		printf("\n");
+	}
+	printf("%-20s", "mean of modes, uA");
+	for ( i = 0; i < elfs; i++ )
+		printf("  %21.1f", total[i] / 9);
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,415 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	harness.c
+// @func:	simavr harness shared by the sim/ tools, see harness.h
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_watchdog.h"
+#include "harness.h"
+#include "stimuli.h"
+
+#define SYMBOLS_MAX	256
+#define NEST_MAX	8
+
+const double WAKE_LIMIT_US = 10e6;	// give up if no watchdog wake by then
+const unsigned int CLOCK_FAST_DIV = 8;	// CLKPR 3, as main.c sets it
+
+avr_t *simAvr = 0;
+SimSection simSections[SIM_SECTIONS];
+unsigned int simClockDiv = 8;		// CKDIV8 fuse, 1MHz out of reset
+
+static elf_firmware_t firmware;
+static struct {
+	char name[32];
+	unsigned int addr;			// data space address
+} symbols[SYMBOLS_MAX];
+static unsigned int symbolCount;
+
+static unsigned char clkpce;		// CLKPCE written, next CLKPR write counts
+static avr_cycle_count_t baseCycle;	// cycle the wall clock was last rebased at
+static double baseUs;				// wall time at baseCycle
+static unsigned char ledLevel;		// PB0 and PB2 output levels, from the port
+
+static struct {
+	unsigned char id;
+	avr_cycle_count_t start;
+	avr_cycle_count_t nested;	// cycles of sections inside this one
+} nest[NEST_MAX];
+static unsigned int depth;
+static unsigned long wdtEntries;	// WDT_vect entries seen
+static unsigned int modeAddr;		// mStatus
+static unsigned int bodsAddr;		// bodsSupported
+static unsigned int sleepBodsAddr;	// sleepBods
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	nowUs
+// @func:	wall time of the current cycle at the current clock
+//////////////////////////////////////////////////////////////////////////
+static double nowUs(void) {
+
+	return baseUs + (double)( simAvr->cycle - baseCycle ) * simClockDiv * 1e6 / SIM_RC_HZ;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	rescaleWatchdog
+// @func:	simavr counts the watchdog period in core cycles at the
+//			frequency of the last WDTCR write, but the 128kHz watchdog
+//			oscillator does not follow CLKPR. Scales its period and the
+//			pending timeout to the new core frequency.
+//////////////////////////////////////////////////////////////////////////
+static void rescaleWatchdog(uint32_t oldHz, uint32_t newHz) {
+
+	avr_io_t *io;
+	avr_watchdog_t *wd = 0;
+	avr_cycle_timer_slot_p slot;
+	avr_cycle_timer_t timer;
+	avr_cycle_count_t left;
+
+	for ( io = simAvr->io_port; io; io = io->next )
+		if ( io->kind && strcmp(io->kind, "watchdog") == 0 )
+			wd = (avr_watchdog_t *)io;
+	if ( !wd )
+		return;
+	wd->cycle_count = wd->cycle_count * newHz / oldHz;
+	for ( slot = simAvr->cycle_timers.timer; slot; slot = slot->next )
+		if ( slot->param == wd ) {
+			timer = slot->timer;
+			left = slot->when > simAvr->cycle ? slot->when - simAvr->cycle : 0;
+			avr_cycle_timer_cancel(simAvr, timer, wd);
+			avr_cycle_timer_register(simAvr, left * newHz / oldHz, timer, wd);
+			break;
+		}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	clkprWrite
+// @func:	follows the CLKPCE, CLKPS sequence of setClock(), rebases
+//			the wall clock and runs the core at the new frequency
+//////////////////////////////////////////////////////////////////////////
+static void clkprWrite(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+
+	uint32_t oldHz = avr->frequency;
+	(void)param;
+
+	avr->data[addr] = v;
+	if ( v & 0x80 ) {	// CLKPCE
+		clkpce = 1;
+		return;
+	}
+	if ( !clkpce )
+		return;
+	clkpce = 0;
+	baseUs = nowUs();
+	baseCycle = avr->cycle;
+	simClockDiv = 1U << ( v & 0x0F );
+	avr->frequency = SIM_RC_HZ / simClockDiv;
+	rescaleWatchdog(oldHz, avr->frequency);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	markerWrite
+// @func:	pairs the BENCH markers written to GPIOR0, nested sections
+//			are taken out of the section they interrupted
+//////////////////////////////////////////////////////////////////////////
+static void markerWrite(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+
+	unsigned char id = v & ~BENCH_EXIT_FLAG;
+	avr_cycle_count_t cycles;
+	SimSection *s;
+	(void)param;
+
+	avr->data[addr] = v;
+	if ( id == 0 || id >= SIM_SECTIONS )
+		return;
+	if ( !( v & BENCH_EXIT_FLAG ) ) {
+		if ( id == BENCH_WDT )
+			wdtEntries++;
+		if ( depth < NEST_MAX ) {
+			nest[depth].id = id;
+			nest[depth].start = avr->cycle;
+			nest[depth].nested = 0;
+		}
+		depth++;
+		return;
+	}
+	if ( depth == 0 )
+		return;
+	depth--;
+	if ( depth >= NEST_MAX || nest[depth].id != id )
+		return;		// unpaired, drop it
+	cycles = avr->cycle - nest[depth].start;
+	if ( depth > 0 && depth - 1 < NEST_MAX )
+		nest[depth - 1].nested += cycles;
+	cycles -= nest[depth].nested;
+	s = &simSections[id];
+	if ( s->count == 0 || cycles < s->min )
+		s->min = cycles;
+	if ( cycles > s->max )
+		s->max = cycles;
+	s->sum += cycles;
+	s->count++;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	ledNotify
+// @func:	tracks the output level of PB0 and PB2, including OC0A
+//////////////////////////////////////////////////////////////////////////
+static void ledNotify(avr_irq_t *irq, uint32_t value, void *param) {
+
+	unsigned char bit = (unsigned char)(uintptr_t)param;
+	(void)irq;
+
+	if ( value )
+		ledLevel |= bit;
+	else
+		ledLevel &= ~bit;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	loadSymbols
+// @func:	reads the data symbols of the elf through avr-nm, $AVR_NM
+//			overrides the tool name
+//////////////////////////////////////////////////////////////////////////
+static int loadSymbols(const char *elf) {
+
+	char cmd[512], line[256], name[64], type;
+	unsigned long addr;
+	const char *nm = getenv("AVR_NM");
+	FILE *f;
+
+	snprintf(cmd, sizeof(cmd), "%s %s", nm ? nm : "avr-nm", elf);
+	if ( !( f = popen(cmd, "r") ) )
+		return -1;
+	symbolCount = 0;
+	while ( fgets(line, sizeof(line), f) && symbolCount < SYMBOLS_MAX ) {
+		if ( sscanf(line, "%lx %c %63s", &addr, &type, name) != 3 )
+			continue;
+		if ( !strchr("bBdD", type) || strlen(name) >= sizeof(symbols[0].name) )
+			continue;
+		strcpy(symbols[symbolCount].name, name);
+		symbols[symbolCount].addr = addr & 0xFFFF;	// data space, less 0x800000
+		symbolCount++;
+	}
+	return pclose(f) == 0 && symbolCount ? 0 : -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simOpen
+// @func:	loads the elf into a new ATtiny45 and hooks the harness in,
+//			the inputs start at mode 1
+// @rtrn:	0, or -1 if the elf or its symbols could not be read
+//////////////////////////////////////////////////////////////////////////
+int simOpen(const char *elf) {
+
+	avr_irq_t *irq;
+
+	if ( elf_read_firmware(elf, &firmware) != 0 || loadSymbols(elf) != 0 ) {
+		fprintf(stderr, "%s: cannot read firmware or symbols\n", elf);
+		return -1;
+	}
+	simAvr = avr_make_mcu_by_name("attiny45");
+	if ( !simAvr )
+		return -1;
+	avr_init(simAvr);
+	avr_load_firmware(simAvr, &firmware);
+	simAvr->frequency = SIM_RC_HZ / 8;
+	simAvr->log = LOG_ERROR;
+
+	avr_register_io_write(simAvr, SIM_CLKPR, clkprWrite, 0);
+	avr_register_io_write(simAvr, SIM_GPIOR0, markerWrite, 0);
+	irq = avr_io_getirq(simAvr, AVR_IOCTL_IOPORT_GETIRQ('B'), PB0);
+	avr_irq_register_notify(irq, ledNotify, (void *)(uintptr_t)(1 << PB0));
+	irq = avr_io_getirq(simAvr, AVR_IOCTL_IOPORT_GETIRQ('B'), PB2);
+	avr_irq_register_notify(irq, ledNotify, (void *)(uintptr_t)(1 << PB2));
+
+	modeAddr = simAddr("mStatus");
+	bodsAddr = simAddr("bodsSupported");
+	sleepBodsAddr = simAddr("sleepBods");
+	simClockDiv = 8;
+	clkpce = 0;
+	baseCycle = simAvr->cycle;
+	baseUs = 0;
+	ledLevel = (1 << PB0) | (1 << PB2);
+	depth = 0;
+	wdtEntries = 0;
+	simClearSections();
+	simInputs(MODE_STIMULI[1].pins, MODE_STIMULI[1].vcc);
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simClose
+// @func:	frees the core, so the next simOpen starts from power-on
+//////////////////////////////////////////////////////////////////////////
+void simClose(void) {
+
+	if ( simAvr )
+		avr_terminate(simAvr);
+	simAvr = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simAddr, simByte, simWord
+// @func:	data address and value of a firmware global
+//////////////////////////////////////////////////////////////////////////
+unsigned int simAddr(const char *symbol) {
+
+	unsigned int i;
+
+	for ( i = 0; i < symbolCount; i++ )
+		if ( strcmp(symbols[i].name, symbol) == 0 )
+			return symbols[i].addr;
+	fprintf(stderr, "no symbol %s\n", symbol);
+	exit(1);
+}
+
+unsigned char simByte(const char *symbol) {
+
+	return simAvr->data[simAddr(symbol)];
+}
+
+unsigned short simWord(const char *symbol) {
+
+	unsigned int addr = simAddr(symbol);
+
+	return simAvr->data[addr] | simAvr->data[addr + 1] << 8;	// little endian
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simInputs
+// @func:	drives the switch, charger and USB pins and sets the supply
+//			the bandgap is measured against
+// @parm:	pins - PINB levels, STIM_* bits
+// @parm:	vcc - supply in mV
+//////////////////////////////////////////////////////////////////////////
+void simInputs(unsigned char pins, unsigned int vcc) {
+
+	static const unsigned char INPUTS[] = { PB1, PB3, PB4 };
+	unsigned int i;
+
+	for ( i = 0; i < sizeof(INPUTS); i++ )
+		avr_raise_irq(avr_io_getirq(simAvr, AVR_IOCTL_IOPORT_GETIRQ('B'), INPUTS[i]),
+			( pins >> INPUTS[i] ) & 1);
+	simAvr->vcc = vcc;
+	simAvr->avcc = vcc;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simWake
+// @func:	runs the core from one WDT_vect entry to the next and splits
+//			the time between them by core state and clock
+// @rtrn:	0, or -1 if the core crashed or never woke
+//////////////////////////////////////////////////////////////////////////
+int simWake(SimWake *w) {
+
+	unsigned long entries = wdtEntries;
+	avr_cycle_count_t cycle;
+	double start = nowUs(), before, dt;
+	unsigned char mcucr, lit, adcOn;
+	int state, sleeping;
+
+	memset(w, 0, sizeof(*w));
+	while ( wdtEntries == entries || wdtEntries == 0 ) {
+		cycle = simAvr->cycle;
+		before = nowUs();
+		sleeping = simAvr->state == cpu_Sleeping;
+		mcucr = simAvr->data[SIM_MCUCR];
+		adcOn = simAvr->data[SIM_ADCSRA] & (1 << ADEN);
+		lit = ~ledLevel & simAvr->data[SIM_DDRB] & ( (1 << PB0) | (1 << PB2) );
+
+		state = avr_run(simAvr);
+		if ( state == cpu_Done || state == cpu_Crashed )
+			return -1;
+
+		dt = nowUs() - before;	// a CLKPR write rebases, but keeps this
+		if ( adcOn )
+			w->adcUs += dt;
+		w->ledUs += dt * ( ( ( lit >> PB0 ) & 1 ) + ( ( lit >> PB2 ) & 1 ) );
+		if ( !sleeping ) {
+			w->cycles += simAvr->cycle - cycle;
+			if ( simClockDiv <= CLOCK_FAST_DIV )
+				w->runFastUs += dt;
+			else
+				w->runSlowUs += dt;
+		}
+		else if ( mcucr & (1 << SM1) ) {
+			w->downUs += dt;
+			if ( simAvr->data[bodsAddr] && simAvr->data[sleepBodsAddr] )
+				w->downBodsUs += dt;	// simavr does not time BODS out
+		}
+		else if ( simClockDiv <= CLOCK_FAST_DIV )
+			w->idleFastUs += dt;
+		else
+			w->idleSlowUs += dt;
+		if ( nowUs() - start > WAKE_LIMIT_US )
+			return -1;
+	}
+	w->us = nowUs() - start;
+	w->mode = simAvr->data[modeAddr];
+	return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simSettle
+// @func:	holds a mode's stimulus until the firmware commits it and
+//			the first period in it is complete
+// @rtrn:	0, or -1 if the mode was not reached
+//////////////////////////////////////////////////////////////////////////
+int simSettle(unsigned char mode) {
+
+	SimWake w;
+	unsigned int i;
+
+	simInputs(MODE_STIMULI[mode].pins, MODE_STIMULI[mode].vcc);
+	for ( i = 0; i < 5000; i++ ) {
+		if ( simWake(&w) )
+			return -1;
+		if ( w.mode == mode )
+			return simWake(&w);
+	}
+	return -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	simClearSections, simSectionName
+// @func:	restarts the section counts, names a BENCH id
+//////////////////////////////////////////////////////////////////////////
+void simClearSections(void) {
+
+	memset(simSections, 0, sizeof(simSections));
+}
+
+const char *simSectionName(unsigned char id) {
+
+	static const char *NAMES[SIM_SECTIONS] = {
+		[BENCH_WDT] = "WDT_vect",
+		[BENCH_ADC] = "ADC_vect",
+		[BENCH_TIM0_OVF] = "TIM0_OVF_vect",
+		[BENCH_TIM0_COMPA] = "TIM0_COMPA_vect",
+		[BENCH_TIM0_COMPB] = "TIM0_COMPB_vect",
+		[BENCH_STATUS] = "getStatus()",
+		[BENCH_SETMODE] = "setMode()",
+		[BENCH_SEQUENCE] = "stepSequence()",
+	};
+
+	return id < SIM_SECTIONS ? NAMES[id] : 0;
+}
@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	harness.h
+// @func:	Runs the avr-gcc build of main.c under simavr for the tools
+//			in sim/. The firmware is built with BENCH, so each WDT_vect
+//			entry marks a wake and GPIOR0 times every section. Time is
+//			kept at the clock CLKPR selects, split by core state, so a
+//			tool can report awake time and apply datasheet currents.
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "sim_avr.h"
+#include "hal.h"	// BENCH ids, the tools build with HOST_BUILD
+
+#define SIM_RC_HZ		8000000UL	// internal RC oscillator, before CLKPR
+#define SIM_SECTIONS	BENCH_SECTIONS	// BENCH ids, index 0 unused
+
+// Data space addresses of the ATtiny45 registers the harness reads
+#define SIM_PINB	0x36
+#define SIM_DDRB	0x37
+#define SIM_PORTB	0x38
+#define SIM_ADCSRA	0x26
+#define SIM_GPIOR0	0x31
+#define SIM_GPIOR1	0x32
+#define SIM_WDTCR	0x41
+#define SIM_CLKPR	0x46
+#define SIM_TCCR0A	0x4A
+#define SIM_TCCR0B	0x53
+#define SIM_OCR0A	0x49
+#define SIM_MCUCR	0x55
+#define SIM_TIMSK	0x59
+#define SIM_PRR		0x40
+
+typedef struct {
+	unsigned long count;
+	unsigned long sum;		// cycles, excluding nested sections
+	unsigned long min;
+	unsigned long max;
+} SimSection;
+
+// One watchdog period, from a WDT_vect entry to the next, in us
+typedef struct {
+	double us;				// wall time
+	double runFastUs;		// core running at CLOCK_FAST
+	double runSlowUs;		// core running at any slower clock
+	double idleFastUs;		// sleeping in idle at CLOCK_FAST
+	double idleSlowUs;		// sleeping in idle at a slower clock
+	double downUs;			// sleeping in power down
+	double downBodsUs;		// of that, with the BOD turned off
+	double adcUs;			// ADEN set
+	double ledUs;			// led on-time, summed over both leds
+	unsigned long cycles;	// core cycles run
+	unsigned char mode;		// mStatus at the end of the period
+} SimWake;
+
+extern avr_t *simAvr;
+extern SimSection simSections[SIM_SECTIONS];
+extern unsigned int simClockDiv;	// current CLKPR division
+
+int simOpen(const char *elf);
+void simClose(void);
+unsigned int simAddr(const char *symbol);
+unsigned char simByte(const char *symbol);
+unsigned short simWord(const char *symbol);
+void simInputs(unsigned char pins, unsigned int vcc);
+int simWake(SimWake *w);
+int simSettle(unsigned char mode);
+void simClearSections(void);
+const char *simSectionName(unsigned char id);
+
+#endif // HARNESS_H
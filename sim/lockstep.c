@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	lockstep.c
+// @func:	runs the host build of main.c and the avr-gcc build under
+//			simavr side by side on the same inputs, one watchdog wake
+//			at a time, and compares the mode, the register profile and
+//			the averaged voltage after every one. Inputs hold a seeded
+//			random mode stimulus while the supply walks around it.
+//			Stops at the first wake the two builds disagree on.
+//			usage: lockstep [elf] [wakes] [seed]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+#include "stimuli.h"
+
+extern unsigned char mStatus;
+extern volatile unsigned short voltage;
+
+const unsigned long HOLD_WAKES = 400;	// longest a stimulus is held
+const unsigned int VCC_MIN = 2900;		// supply walk bounds, mV
+const unsigned int VCC_MAX = 4300;
+
+typedef struct {
+	const char *name;
+	unsigned int addr;		// data space address in simavr
+	volatile uint8_t *host;	// the hal_host.c register
+	unsigned char mask;		// bits compared
+} Register;
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	portMask
+// @func:	PORTB bits the timer drives between wakes, so a wake can
+//			catch them either way. The led pulse and sigma-delta glow
+//			toggle PB2 from the Timer 0 vectors, the PWM modes drive
+//			PB0 from OC0A over the port.
+//////////////////////////////////////////////////////////////////////////
+static unsigned char portMask(void) {
+
+	unsigned char mask = 0xFF;
+
+	if ( TIMSK & ( (1 << OCIE0A) | (1 << TOIE0) ) )
+		mask &= ~(1 << PB2);
+	if ( TCCR0A & (1 << COM0A1) )
+		mask &= ~(1 << PB0);
+	return mask;
+}
+
+
+int main(int argc, char **argv) {
+
+	const Register REGISTERS[] = {
+		{ "DDRB", SIM_DDRB, &DDRB, 0xFF },
+		{ "PORTB", SIM_PORTB, &PORTB, 0xFF },
+		{ "TCCR0A", SIM_TCCR0A, &TCCR0A, 0xFF },
+		{ "TCCR0B", SIM_TCCR0B, &TCCR0B, 0xFF },
+		{ "TIMSK", SIM_TIMSK, &TIMSK, 0xFF },
+		{ "MCUCR", SIM_MCUCR, &MCUCR, (1 << SM1) },
+		{ "ADCSRA", SIM_ADCSRA, &ADCSRA, (1 << ADEN) },
+		{ "WDTCR", SIM_WDTCR, &WDTCR, (1 << WDIE) | (1 << WDP3) | 0x07 },
+		{ "PRR", SIM_PRR, &PRR, 0xFF },
+		{ "CLKPR", SIM_CLKPR, &CLKPR, 0x0F },
+	};
+	const char *elf = argc > 1 ? argv[1] : "main.elf";
+	unsigned long wakes = argc > 2 ? strtoul(argv[2], 0, 0) : 20000UL;
+	unsigned long seed = argc > 3 ? strtoul(argv[3], 0, 0) : 1;
+	unsigned long i, hold = 0;
+	unsigned long seen = 0;		// bit per mode reached
+	unsigned int vcc = 0, tolerance, r;
+	unsigned short simVolt;
+	unsigned char pins = 0, mode, simMode, hostBits, simBits;
+	SimWake w;
+
+	// both asleep after setup() and the first loop() pass
+	if ( simOpen(elf) || simWake(&w) ) {
+		printf("%s did not reach the first watchdog wake\n", elf);
+		return 1;
+	}
+	MCUSR = (1 << PORF);
+	setup();
+	loop();
+
+	for ( i = 0; i < wakes; i++ ) {
+		if ( hold == 0 ) {
+			seed = seed * 1103515245UL + 12345UL;
+			mode = ( seed >> 16 ) % 9 + 1;
+			hold = ( seed >> 8 ) % HOLD_WAKES + 1;
+			pins = MODE_STIMULI[mode].pins;
+			vcc = MODE_STIMULI[mode].vcc;
+		}
+		hold--;
+		seed = seed * 1103515245UL + 12345UL;
+		vcc += ( ( seed >> 16 ) % 3 ) * 5 - 5;	// -5, 0 or +5 mV
+		if ( vcc < VCC_MIN )
+			vcc = VCC_MIN;
+		if ( vcc > VCC_MAX )
+			vcc = VCC_MAX;
+
+		PINB = pins;
+		hal_vcc = vcc;
+		hal_wake();
+		simInputs(pins, vcc);
+		if ( simWake(&w) ) {
+			printf("wake %lu: core stopped\n", i);
+			return 1;
+		}
+		seen |= 1UL << mStatus;
+
+		simMode = simByte("mStatus");
+		if ( simMode != mStatus ) {
+			printf("wake %lu pins %02x %u mV: mode host %u sim %u\n",
+				i, pins, vcc, mStatus, simMode);
+			return 1;
+		}
+		for ( r = 0; r < sizeof(REGISTERS) / sizeof(REGISTERS[0]); r++ ) {
+			const Register *reg = &REGISTERS[r];
+			unsigned char mask = reg->mask & ( reg->host == &PORTB ? portMask() : 0xFF );
+			hostBits = *reg->host & mask;
+			simBits = simAvr->data[reg->addr] & mask;
+			if ( hostBits != simBits ) {
+				printf("wake %lu pins %02x %u mV mode %u: %s host %02x sim %02x\n",
+					i, pins, vcc, mStatus, reg->name, hostBits, simBits);
+				return 1;
+			}
+		}
+		// one ADC count at this voltage, the builds round the
+		// bandgap reading apart
+		simVolt = simWord("voltage");
+		tolerance = (unsigned long)voltage * voltage / 1126400UL + 1;
+		if ( abs( (int)simVolt - (int)voltage ) > (int)tolerance ) {
+			printf("wake %lu pins %02x %u mV mode %u: voltage host %u sim %u\n",
+				i, pins, vcc, mStatus, voltage, simVolt);
+			return 1;
+		}
+	}
+	simClose();
+	printf("%lu wakes in lockstep, modes reached %03lx\n", wakes, seen);
+	return 0;
+}
@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////////
+// @name:	timeline.c
+// @func:	simavr side of host/timeline. Replays a field trace against
+//			an elf and prints one line per watchdog wake in the same
+//			first five columns: the wake time in ms, the inputs, the
+//			mode after it and the led states. The last column is the
+//			core cycles the wake ran. Two elfs diff the same way the
+//			host builds do, and the first five columns of either tool's
+//			output compare the host build against simavr. Without a trace
+//			each mode's stimulus is held for HOLD_MS in turn.
+//			usage: timeline [elf] [trace]
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "harness.h"
+#include "stimuli.h"
+
+#define RECORDS_MAX	4096
+
+const unsigned long HOLD_MS = 30000;	// per mode, default trace
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	loadTrace
+// @func:	reads a field trace, in the format hal_trace_parse reads
+// @rtrn:	number of records, 0 if unreadable or empty
+//////////////////////////////////////////////////////////////////////////
+static unsigned int loadTrace(const char *name, TraceRecord *trace) {
+
+	FILE *f = fopen(name, "r");
+	unsigned int count = 0, pins;
+	char line[128];
+
+	if ( !f ) {
+		perror(name);
+		return 0;
+	}
+	while ( count < RECORDS_MAX && fgets(line, sizeof(line), f) ) {
+		if ( line[0] == '#' )
+			continue;
+		if ( sscanf(line, "%lu %x %u", &trace[count].ms, &pins, &trace[count].vcc) != 3 )
+			continue;
+		trace[count++].pins = pins;
+	}
+	fclose(f);
+	return count;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// @name:	ledChar
+// @func:	state of one led: '-' pin not driven, '1' lit, '0' dark,
+//			'~' driven by Timer 0 between wakes
+//////////////////////////////////////////////////////////////////////////
+static char ledChar(unsigned char pin, unsigned char timer) {
+
+	if ( !( simAvr->data[SIM_DDRB] & (1 << pin) ) )
+		return '-';
+	if ( timer )
+		return '~';
+	return ( simAvr->data[SIM_PORTB] & (1 << pin) ) ? '0' : '1';	// low lights the led
+}
+
+
+int main(int argc, char **argv) {
+
+	static TraceRecord trace[RECORDS_MAX];
+	const char *elf = argc > 1 ? argv[1] : "main.elf";
+	unsigned int count, i = 0;
+	unsigned char mode, pins = 0;
+	unsigned int vcc = 0;
+	double us = 0;
+	unsigned long ms;
+	SimWake w;
+
+	if ( argc > 2 ) {
+		count = loadTrace(argv[2], trace);
+		if ( count == 0 )
+			return 1;
+	}
+	else {
+		// last record holds mode 9 for its HOLD_MS
+		count = 10;
+		for ( mode = 1; mode <= count; mode++ ) {
+			trace[mode - 1].ms = ( mode - 1 ) * HOLD_MS;
+			trace[mode - 1].pins = MODE_STIMULI[mode < 9 ? mode : 9].pins;
+			trace[mode - 1].vcc = MODE_STIMULI[mode < 9 ? mode : 9].vcc;
+		}
+	}
+
+	// asleep after setup() and the first loop() pass, time 0 is the
+	// first watchdog wake as in hal_replay
+	if ( simOpen(elf) || simWake(&w) ) {
+		printf("%s did not reach the first watchdog wake\n", elf);
+		return 1;
+	}
+	printf("# ms, PINB, mV, mode, red and green led, cycles\n");
+	for ( ms = trace[0].ms; ms <= trace[count - 1].ms; ms = trace[0].ms + (unsigned long)( us / 1e3 ) ) {
+		while ( i < count && trace[i].ms <= ms ) {
+			pins = trace[i].pins;
+			vcc = trace[i].vcc;
+			i++;
+		}
+		simInputs(pins, vcc);
+		if ( simWake(&w) ) {
+			printf("%8lu core stopped\n", ms);
+			return 1;
+		}
+		us += w.us;
+		printf("%8lu %02x %4u %u %c%c %6lu\n", ms, pins, vcc, w.mode,
+			ledChar(PB0, simAvr->data[SIM_TCCR0A] & (1 << COM0A1)),
+			ledChar(PB2, simAvr->data[SIM_TIMSK] & ( (1 << OCIE0A) | (1 << TOIE0) )),
+			w.cycles);
+	}
+	simClose();
+	return 0;
+}